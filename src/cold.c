@@ -0,0 +1,388 @@
+#include <string.h>
+#include "editor.h"
+#include "highlight.h"
+#include "cold.h"
+
+/*
+ * Cold storage keeps the lines far from the view compressed, so a file
+ * larger than the buffer can be edited. The store follows a scratch
+ * area after the text: first the chunks before the text, the nearest
+ * one first, then the chunks after it, again the nearest one first.
+ * A chunk holds whole lines and starts with its packed and plain sizes
+ * and the lexer state at its end.
+ *
+ * The codec is LZ77 within the chunk: a byte below 0x80 is followed by
+ * that many literals plus one, a byte from 0x80 and the next one hold a
+ * match of 3 to 34 bytes up to 1024 bytes back.
+ */
+
+#define HASH_BITS			9
+#define MIN_MATCH			3
+#define MAX_MATCH			(MIN_MATCH + 31)
+#define MAX_DISTANCE		1024
+#define MAX_LITERALS		128
+#define NOPOS				0xFFFF
+#define HASH(p)				((uint16_t) ((((uint32_t) (p)[0] << 16 | (p)[1] << 8 | (p)[2]) * 2654435761u) >> (32 - HASH_BITS)))
+
+static cold_t *cs = NULL;
+
+static uint8_t *store();
+static offset_t get16(const uint8_t *src);
+static void put16(uint8_t *dst, offset_t value);
+static offset_t count_lines(const uint8_t *src, offset_t size);
+static offset_t chunk_size();
+static offset_t chunk_end(offset_t limit);
+static offset_t chunk_start(offset_t limit);
+static offset_t pack_chunk(uint8_t *dst, offset_t start, offset_t size);
+static offset_t pack(const uint8_t *src, offset_t size, uint8_t *dst, offset_t cap);
+static void unpack(const uint8_t *src, offset_t size, uint8_t *dst);
+
+void
+cold_select(cold_t *_cs)
+{
+  cs = _cs;
+}
+
+void
+cold_init(uint8_t enabled)
+{
+  memset(cs, 0, sizeof *cs);
+  cs->enabled = enabled;
+}
+
+/* the bytes after the text of c */
+size_t
+cold_extent(const cold_t *c)
+{
+  if (!c->enabled) {
+    return 0;
+  }
+  return COLD_SCRATCH + c->head_size + c->tail_size;
+}
+
+uint8_t *
+cold_scratch()
+{
+  return ed->text + ed->maxtext + 2;
+}
+
+/* plain size of the chunk next to the text, 0 without one */
+offset_t
+cold_next_raw(uint8_t tail)
+{
+  if (tail ? cs->tail_size == 0 : cs->head_size == 0) {
+    return 0;
+  }
+  return get16(store() + (tail ? cs->head_size : 0) + 2);
+}
+
+/* the lexer state at the start of the text */
+uint8_t
+cold_head_state()
+{
+  if (!cs->enabled || cs->head_size == 0) {
+    return 0;
+  }
+  return store()[4];
+}
+
+/* compress lines from the top of the text, up to limit */
+int
+cold_freeze_head(offset_t limit)
+{
+  offset_t end = chunk_end(limit);
+  if (end == 0) {
+    return 0;
+  }
+  uint8_t *scratch = cold_scratch();
+  offset_t size = pack_chunk(scratch, 0, end);
+  if (size == 0) {
+    return 0;
+  }
+  uint8_t state = hl_state(end);
+  scratch[4] = state;
+  cs->head_lines += count_lines(ed->text, end);
+  cut_head(end);
+  /* the chunk goes before the store, over the end of the scratch area */
+  memmove(scratch + COLD_SCRATCH - size, scratch, size);
+  ed->maxtext -= size;
+  cs->head_size += size;
+  cs->head_raw += end;
+  cs->shifted = 1;
+  hl_set_base(state);
+  return 1;
+}
+
+/* compress lines from the bottom of the text, down to limit */
+int
+cold_freeze_tail(offset_t limit)
+{
+  offset_t start = chunk_start(limit);
+  if (start >= ed->numtext) {
+    return 0;
+  }
+  offset_t raw = ed->numtext - start;
+  uint8_t *scratch = cold_scratch();
+  uint8_t *head = scratch + COLD_SCRATCH;
+  offset_t size = pack_chunk(scratch, start, raw);
+  if (size == 0) {
+    return 0;
+  }
+  scratch[4] = 0;
+  cut_tail(start);
+  /* the chunk goes between the head and the tail, in the freed text */
+  memmove(scratch - size, scratch, size);
+  memmove(head - size, head, cs->head_size);
+  memcpy(head - size + cs->head_size, scratch - size, size);
+  ed->maxtext -= size;
+  cs->tail_size += size;
+  cs->tail_raw += raw;
+  cs->shifted = 1;
+  hl_changed(start);
+  return 1;
+}
+
+int
+cold_thaw_head()
+{
+  if (cs->head_size == 0) {
+    return 0;
+  }
+  uint8_t *chunk = store();
+  offset_t size = COLD_HEADER + get16(chunk);
+  offset_t raw = get16(chunk + 2);
+  if (ed->numtext + raw >= ed->maxtext) {
+    return 0;
+  }
+  uint8_t *scratch = cold_scratch();
+  unpack(chunk + COLD_HEADER, size - COLD_HEADER, scratch);
+  cs->head_lines -= count_lines(scratch, raw);
+  insert_head(scratch, raw);
+  ed->maxtext += size;
+  cs->head_size -= size;
+  cs->head_raw -= raw;
+  hl_set_base(cold_head_state());
+  return 1;
+}
+
+int
+cold_thaw_tail()
+{
+  if (cs->tail_size == 0) {
+    return 0;
+  }
+  uint8_t *head = store();
+  uint8_t *chunk = head + cs->head_size;
+  offset_t size = COLD_HEADER + get16(chunk);
+  offset_t raw = get16(chunk + 2);
+  if (ed->numtext + raw >= ed->maxtext) {
+    return 0;
+  }
+  offset_t start = ed->numtext;
+  uint8_t *scratch = cold_scratch();
+  unpack(chunk + COLD_HEADER, size - COLD_HEADER, scratch);
+  append_tail(scratch, raw);
+  memmove(head + size, head, cs->head_size);
+  ed->maxtext += size;
+  cs->tail_size -= size;
+  cs->tail_raw -= raw;
+  hl_changed(start);
+  return 1;
+}
+
+/*
+ * Decompress the chunk at index in the order of the file, either before
+ * or after the text, into the scratch area. Returns its plain size, or
+ * 0 past the last one.
+ */
+offset_t
+cold_unpack(uint8_t tail, uint16_t index)
+{
+  uint8_t *chunk = store();
+  uint8_t *end = chunk + cs->head_size;
+  if (tail) {
+    chunk = end;
+    end += cs->tail_size;
+  } else {
+    /* the chunks before the text are stored the nearest first */
+    uint16_t count = 0;
+    for (uint8_t *p = chunk; p < end; p += COLD_HEADER + get16(p)) {
+      count ++;
+    }
+    if (index >= count) {
+      return 0;
+    }
+    index = count - 1 - index;
+  }
+  while (index -- > 0 && chunk < end) {
+    chunk += COLD_HEADER + get16(chunk);
+  }
+  if (chunk >= end) {
+    return 0;
+  }
+  unpack(chunk + COLD_HEADER, get16(chunk), cold_scratch());
+  return get16(chunk + 2);
+}
+
+/* support functions */
+
+static uint8_t *
+store()
+{
+  return cold_scratch() + COLD_SCRATCH;
+}
+
+static offset_t
+get16(const uint8_t *src)
+{
+  return src[0] | (src[1] << 8);
+}
+
+static void
+put16(uint8_t *dst, offset_t value)
+{
+  dst[0] = value & 0xFF;
+  dst[1] = value >> 8;
+}
+
+static offset_t
+count_lines(const uint8_t *src, offset_t size)
+{
+  offset_t count = 0;
+  while (size --) {
+    count += (*src++ == LF);
+  }
+  return count;
+}
+
+/* smaller chunks in a small text, so that one can always come back */
+static offset_t
+chunk_size()
+{
+  offset_t size = ed->maxtext / 4;
+  return size < COLD_CHUNK ? size : COLD_CHUNK;
+}
+
+/* the end of the lines from the top making up a chunk, 0 for none */
+static offset_t
+chunk_end(offset_t limit)
+{
+  offset_t end = 0;
+  while (end < chunk_size() && end < limit) {
+    offset_t next = get_line_end(end);
+    if (next > limit || next > COLD_MAX || ed->text[next - 1] != LF) {
+      break;
+    }
+    end = next;
+  }
+  return end;
+}
+
+/* the start of the lines from the bottom making up a chunk, numtext for none */
+static offset_t
+chunk_start(offset_t limit)
+{
+  offset_t start = ed->numtext;
+  while (start > 0 && ed->numtext - start < chunk_size()) {
+    offset_t prev = get_line_start(start - 1);
+    if (prev < limit || ed->numtext - prev > COLD_MAX) {
+      break;
+    }
+    start = prev;
+  }
+  return start;
+}
+
+/* header and data of a chunk, 0 unless it is smaller than the text */
+static offset_t
+pack_chunk(uint8_t *dst, offset_t start, offset_t size)
+{
+  if (size <= COLD_HEADER + 1) {
+    return 0;
+  }
+  offset_t packed = pack(&ed->text[start], size, dst + COLD_HEADER, size - COLD_HEADER - 1);
+  if (packed == 0) {
+    return 0;
+  }
+  put16(dst, packed);
+  put16(dst + 2, size);
+  return COLD_HEADER + packed;
+}
+
+/* returns the packed size, 0 if it does not fit in cap */
+static offset_t
+pack(const uint8_t *src, offset_t size, uint8_t *dst, offset_t cap)
+{
+  uint16_t table[1 << HASH_BITS];
+  offset_t in = 0, out = 0, literal = 0;
+  uint8_t run = 0;
+
+  for (int i = 0; i < (1 << HASH_BITS); i ++) {
+    table[i] = NOPOS;
+  }
+  while (in < size) {
+    offset_t length = 0, distance = 0;
+    if (in + MIN_MATCH <= size) {
+      uint16_t h = HASH(&src[in]);
+      offset_t from = table[h];
+      table[h] = in;
+      if (from != NOPOS && in - from <= MAX_DISTANCE) {
+        while (in + length < size && length < MAX_MATCH && src[from + length] == src[in + length]) {
+          length ++;
+        }
+        distance = in - from;
+      }
+    }
+    if (length >= MIN_MATCH) {
+      if (out + 2 > cap) {
+        return 0;
+      }
+      dst[out++] = 0x80 | ((length - MIN_MATCH) << 2) | ((distance - 1) >> 8);
+      dst[out++] = (distance - 1) & 0xFF;
+      in ++;
+      while (-- length > 0) {
+        if (in + MIN_MATCH <= size) {
+          table[HASH(&src[in])] = in;
+        }
+        in ++;
+      }
+      run = 0;
+      continue;
+    }
+    if (run == 0 || run == MAX_LITERALS) {
+      if (out >= cap) {
+        return 0;
+      }
+      literal = out ++;
+      run = 0;
+    }
+    if (out >= cap) {
+      return 0;
+    }
+    dst[literal] = run ++;
+    dst[out++] = src[in++];
+  }
+  return out;
+}
+
+static void
+unpack(const uint8_t *src, offset_t size, uint8_t *dst)
+{
+  const uint8_t *end = src + size;
+  while (src < end) {
+    uint8_t token = *src++;
+    if (token < 0x80) {
+      offset_t count = token + 1;
+      while (count --) {
+        *dst++ = *src++;
+      }
+    } else {
+      offset_t count = ((token >> 2) & 0x1F) + MIN_MATCH;
+      offset_t distance = (((token & 3) << 8) | *src++) + 1;
+      const uint8_t *from = dst - distance;
+      while (count --) {
+        *dst++ = *from++;
+      }
+    }
+  }
+}
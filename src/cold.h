@@ -0,0 +1,42 @@
+#ifndef __COLD_H
+#define __COLD_H
+
+#include <stddef.h>
+#include "editor.h"
+
+#define COLD_CHUNK			1024
+#define COLD_MAX			(2 * COLD_CHUNK)
+#define COLD_HEADER			5
+#define COLD_SCRATCH		(COLD_MAX + COLD_HEADER)
+
+/* the compressed text before and after the text of one editor context */
+typedef struct {
+  uint8_t enabled;
+  /* the offsets in the text are not the ones in the file */
+  uint8_t shifted;
+  uint32_t head_size, tail_size;
+  uint32_t head_raw, tail_raw;
+  uint32_t head_lines;
+} cold_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void cold_select(cold_t *_cs);
+  void cold_init(uint8_t enabled);
+  size_t cold_extent(const cold_t *c);
+  uint8_t *cold_scratch();
+  offset_t cold_next_raw(uint8_t tail);
+  uint8_t cold_head_state();
+  int cold_freeze_head(offset_t limit);
+  int cold_freeze_tail(offset_t limit);
+  int cold_thaw_head();
+  int cold_thaw_tail();
+  offset_t cold_unpack(uint8_t tail, uint16_t index);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __COLD_H */
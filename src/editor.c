@@ -2,79 +2,196 @@
 #include <stdint.h>
 #include "editor.h"
 
-uint8_t *text = 0;
-uint16_t maxtext, numtext;
-uint16_t lines[MAX_ROWS];
-uint8_t curx, cury;
-uint16_t cursor;
-uint8_t modified;
-enum DrawMode drawmode;
+editor_t *ed = NULL;
 uint8_t tabwidth = 4;
-uint8_t rows = MAX_ROWS;
+uint8_t wrapmode = 0;
 
-#define NOLINE			0xFFFF
-#define SCROLL_ROWS		(rows/2)
+static uint8_t *(*resize_func)(offset_t *) = NULL;
+static void (*change_func)(offset_t) = NULL;
+
+/* the region being filtered: [filter_out, filter_in) is a hole */
+static offset_t filter_from, filter_out, filter_in, filter_stop, filter_last;
+
+/* what edit_lines() does to each line */
+enum {
+  LE_INDENT = 0, LE_DEDENT, LE_COMMENT, LE_UNCOMMENT
+};
+
+static const uint8_t spaces[] = "        ";
+
+/* character classes: the bytes of UTF-8 sequences are word characters */
+enum {
+  CC_OTHER = 0, CC_BLANK, CC_WORD
+};
+
+static const uint8_t char_class[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, 0,
+  0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 2,
+  0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+};
+
+#define SCROLL_ROWS		(ed->rows/2)
 #define IS_LFORNUL(c)   (((c)==LF)||((c)==NUL))
+#define IS_CONT(c)      (((c)&0xC0)==0x80)
+#define IS_WORD(c)      (char_class[(uint8_t) (c)]==CC_WORD)
 
 static void set_eof();
-static void setup_lines(uint8_t start, uint16_t offset);
-static int insert(uint16_t added);
-static int delete(uint16_t removed);
-static void insert_line(uint8_t line);
-static void delete_line(uint8_t line);
-static void update_lines(uint8_t line, uint8_t count, uint16_t offset);
-static int scroll_up(uint8_t delta);
-static int scroll_down(uint8_t delta);
-static void move_bottom(uint16_t offset);
-static uint16_t prevline(uint16_t offset);
-static uint16_t nextline(uint16_t offset);
-static uint8_t get_curx();
-static uint16_t adjust_curx(uint8_t *org);
+static void setup_lines(row_t start, offset_t offset);
+static int reserve(offset_t added);
+static int resize(offset_t size);
+static int insert(offset_t added);
+static int delete(offset_t removed);
+static void touch(offset_t offset);
+static void reveal(offset_t offset);
+static void reflow(offset_t offset);
+static void locate();
+static void rotate(offset_t start, offset_t middle, offset_t end);
+static void get_block(offset_t *start, offset_t *end);
+static void edit_lines(offset_t start, offset_t end, uint8_t mode, offset_t indent);
+static offset_t line_change(offset_t line, uint8_t mode, offset_t indent, offset_t *at);
+static void follow_change(offset_t *to, offset_t offset, offset_t at, offset_t size, uint8_t grows);
+static offset_t skip_blanks(offset_t offset);
+static int is_blank_line(offset_t line);
+static void reverse(offset_t start, offset_t end);
+static void insert_line(row_t line);
+static void delete_line(row_t line);
+static void update_lines(row_t line, row_t count, offset_t offset);
+static void move_top(offset_t offset);
+static offset_t count_lf(offset_t from, offset_t to);
+static int scroll_up(row_t delta);
+static int scroll_down(row_t delta);
+static void shift_rows(row_t delta);
+static offset_t drop_head();
+static offset_t cut_offset(offset_t offset, offset_t end);
+static void move_bottom(offset_t offset);
+static offset_t prevline(offset_t offset);
+static offset_t nextline(offset_t offset);
+static offset_t row_start(offset_t offset);
+static offset_t prev_char(offset_t offset);
+static uint32_t decode(const uint8_t *src, uint8_t len);
+static void rewrap();
+static col_t get_curx();
+static col_t column_of(offset_t offset);
+static offset_t adjust_curx(col_t *org);
+static offset_t find_curx(col_t *org);
+static void colmap_sync();
+static void colmap_extend(offset_t offset, col_t x);
+static void colmap_truncate(offset_t offset);
 
 /* for initializing */
 
 void
-init_editor(uint8_t *_text, uint16_t max, uint8_t _rows)
+init_editor(editor_t *_ed, uint8_t *_text, offset_t max, offset_t *_lines, row_t _rows, col_t _columns)
 {
-  text = _text;
-  maxtext = max - 2;
-  rows = _rows > MAX_ROWS ? MAX_ROWS : _rows;
+  ed = _ed;
+  ed->columns = _columns;
+  ed->text = _text;
+  ed->maxtext = max - 2;
+  ed->lines = _lines;
+  ed->rows = _rows;
   import_start();
 }
 
+/*
+ * The text is size bytes that are not copied and cannot be written, such
+ * as a file mapped from ROM. They end with a LF, which is left out and
+ * stands for the NUL after the text, so nothing ever scans past them.
+ */
+void
+init_mapped(editor_t *_ed, const uint8_t *_text, offset_t size, offset_t *_lines, row_t _rows, col_t _columns)
+{
+  static uint8_t empty[2];
+  init_editor(_ed, empty, sizeof empty, _lines, _rows, _columns);
+  ed->text = (uint8_t *) _text;
+  ed->numtext = ed->maxtext = size - 1;
+  import_end();
+}
+
+void
+select_editor(editor_t *_ed)
+{
+  ed = _ed;
+}
+
+/* move the view to a table of _rows rows, from the row starting at top */
+void
+set_view(offset_t *_lines, row_t _rows, offset_t top)
+{
+  ed->lines = _lines;
+  ed->rows = _rows;
+  ed->lines[0] = top;
+  update_lines(0, _rows, top);
+  locate();
+  ed->drawmode = DM_FULL;
+}
+
+void
+set_resize_func(uint8_t *(*_resize)(offset_t *))
+{
+  resize_func = _resize;
+}
+
+void
+set_change_func(void (*_change)(offset_t))
+{
+  change_func = _change;
+}
+
 void
 import_start()
 {
-  numtext = 0;
-  lines[0] = 0;
-  for (int i = 1; i < MAX_ROWS; i ++) {
-    lines[i] = NOLINE;
+  ed->numtext = 0;
+  ed->lines[0] = 0;
+  for (int i = 1; i < ed->rows; i ++) {
+    ed->lines[i] = NOLINE;
   }
-  curx = cury = 0;
-  cursor = 0;
+  ed->curx = ed->cury = 0;
+  ed->cursor = 0;
+  ed->mark = NOLINE;
+  ed->topline = 0;
+  ed->leftcol = 0;
+  ed->colmap_top = NOLINE;
+  ed->wrap_from = NOLINE;
+  ed->dirty_from = NOLINE;
+  ed->saved_size = 0;
   set_eof();
-  modified = 0;
-  drawmode = DM_NONE;
+  ed->modified = 0;
+  ed->drawmode = DM_NONE;
 }
 
 int
 import_data(const uint8_t *src, int size)
 {
-  uint8_t *dst = &text[numtext];
   int noerror = 1;
 
   while (size --) {
 	uint8_t ch = *src++;
 
 	if (!(ch == TAB || ch == LF || ch >= ' ')) {
+	  /* the text no longer matches the file from here */
+	  if (ed->numtext < ed->dirty_from) {
+		ed->dirty_from = ed->numtext;
+	  }
 	  continue;
 	}
-	if (numtext >= maxtext) {
+	if (ed->numtext >= ed->maxtext && !reserve(size + 1)) {
 	  noerror = 0;
 	  break;
 	}
-	*dst++ = ch;
-	numtext ++;
+	ed->text[ed->numtext ++] = ch;
   }
   set_eof();
   return noerror;
@@ -84,7 +201,211 @@ void
 import_end()
 {
   setup_lines(0, 0);
-  drawmode = DM_FULL;
+  ed->saved_size = ed->numtext;
+  ed->drawmode = DM_FULL;
+}
+
+void
+mark_saved()
+{
+  ed->dirty_from = NOLINE;
+  ed->saved_size = ed->numtext;
+  ed->modified = 0;
+}
+
+/*
+ * Append to the end of text for follow mode. When the buffer is full
+ * the oldest lines are dropped, a quarter of the buffer at a time, so
+ * the cost of moving the text is spread over many appends.
+ */
+int
+append_data(const uint8_t *src, int size)
+{
+  offset_t start = ed->numtext;
+  int noerror = 1;
+
+  while (size --) {
+	uint8_t ch = *src++;
+
+	if (!(ch == TAB || ch == LF || ch >= ' ')) {
+	  continue;
+	}
+	if (ed->numtext >= ed->maxtext && !reserve(size + 1)) {
+	  offset_t dropped = drop_head();
+	  if (dropped == 0) {
+		noerror = 0;
+		break;
+	  }
+	  start = (start > dropped) ? start - dropped : 0;
+	}
+	ed->text[ed->numtext ++] = ch;
+  }
+  set_eof();
+  ed->colmap_top = NOLINE;
+  if (change_func != NULL) {
+    (*change_func)(start);
+  }
+  /* the last row may have grown and the rows below it are new */
+  row_t y = ed->rows - 1;
+  while (y > 0 && ed->lines[y] == NOLINE) {
+    y --;
+  }
+  update_lines(y, ed->rows - y, ed->lines[y]);
+  return noerror;
+}
+
+void
+fit_buffer()
+{
+  uint32_t size = (uint32_t) ed->numtext + 2 + BUFFER_CHUNK;
+  size -= size % BUFFER_CHUNK;
+  if (resize_func == NULL || size >= (uint32_t) ed->maxtext + 2) {
+    return;
+  }
+  resize(size);
+}
+
+int
+reserve_text(offset_t added)
+{
+  return reserve(added);
+}
+
+/*
+ * For text kept out of the buffer: the text can lose or gain whole lines
+ * at either end without being modified. An offset that was dropped with
+ * the head goes to 0, and one dropped with the tail to the new end; a
+ * mark that was dropped is lost.
+ */
+
+/* drop [0, end), which starts the line at end */
+void
+cut_head(offset_t end)
+{
+  offset_t dropped = count_lf(0, end);
+  offset_t count = ed->numtext - end;
+  const uint8_t *src = &ed->text[end];
+  uint8_t *dst = &ed->text[0];
+  while (count --) {
+    *dst++ = *src++;
+  }
+  ed->numtext -= end;
+  set_eof();
+  ed->cursor = cut_offset(ed->cursor, end);
+  if (ed->mark != NOLINE) {
+    ed->mark = (ed->mark < end) ? NOLINE : ed->mark - end;
+  }
+  if (ed->dirty_from != NOLINE) {
+    ed->dirty_from = cut_offset(ed->dirty_from, end);
+  }
+  if (ed->wrap_from != NOLINE) {
+    ed->wrap_from = cut_offset(ed->wrap_from, end);
+  }
+  ed->colmap_top = NOLINE;
+  if (ed->lines[0] >= end) {
+    ed->topline -= dropped;
+    for (int i = 0; i < ed->rows; i ++) {
+      if (ed->lines[i] != NOLINE) {
+        ed->lines[i] -= end;
+      }
+    }
+  } else {
+    /* the view went with them */
+    ed->topline = 0;
+    ed->lines[0] = 0;
+    update_lines(0, ed->rows, 0);
+    ed->drawmode = DM_FULL;
+  }
+}
+
+/* drop [start, numtext), where start is the start of a line */
+void
+cut_tail(offset_t start)
+{
+  ed->numtext = start;
+  set_eof();
+  ed->cursor = min(ed->cursor, start);
+  if (ed->mark != NOLINE && ed->mark > start) {
+    ed->mark = NOLINE;
+  }
+  if (ed->dirty_from != NOLINE) {
+    ed->dirty_from = min(ed->dirty_from, start);
+  }
+  if (ed->wrap_from != NOLINE) {
+    ed->wrap_from = min(ed->wrap_from, start);
+  }
+  colmap_truncate(start);
+  for (int i = 0; i < ed->rows; i ++) {
+    if (ed->lines[i] != NOLINE && ed->lines[i] > start) {
+      ed->lines[i] = NOLINE;
+      ed->drawmode = DM_FULL;
+    }
+  }
+}
+
+/* put whole lines before the text, returns 0 if they do not fit */
+int
+insert_head(const uint8_t *src, offset_t size)
+{
+  if (ed->numtext + size >= ed->maxtext) {
+    return 0;
+  }
+  offset_t count = ed->numtext + 1;
+  const uint8_t *from = &ed->text[ed->numtext];
+  uint8_t *dst = &ed->text[ed->numtext + size];
+  while (count --) {
+    *dst-- = *from--;
+  }
+  dst = &ed->text[0];
+  for (offset_t i = 0; i < size; i ++) {
+    *dst++ = *src++;
+  }
+  ed->numtext += size;
+  ed->cursor += size;
+  if (ed->mark != NOLINE) {
+    ed->mark += size;
+  }
+  /* 0 may stand for a change in the text dropped before */
+  if (ed->dirty_from != NOLINE && ed->dirty_from > 0) {
+    ed->dirty_from += size;
+  }
+  if (ed->wrap_from != NOLINE) {
+    ed->wrap_from += size;
+  }
+  ed->colmap_top = NOLINE;
+  for (int i = 0; i < ed->rows; i ++) {
+    if (ed->lines[i] != NOLINE) {
+      ed->lines[i] += size;
+    }
+  }
+  ed->topline += count_lf(0, size);
+  return 1;
+}
+
+/* put lines after the text, which ends a line, returns 0 if they do not fit */
+int
+append_tail(const uint8_t *src, offset_t size)
+{
+  if (ed->numtext + size >= ed->maxtext) {
+    return 0;
+  }
+  offset_t start = ed->numtext;
+  uint8_t *dst = &ed->text[start];
+  for (offset_t i = 0; i < size; i ++) {
+    *dst++ = *src++;
+  }
+  ed->numtext += size;
+  set_eof();
+  colmap_truncate(start);
+  row_t y = ed->rows - 1;
+  while (y > 0 && ed->lines[y] == NOLINE) {
+    y --;
+  }
+  if (y < ed->rows - 1 || ed->lines[y] == start) {
+    update_lines(y, ed->rows - y, ed->lines[y]);
+    ed->drawmode = DM_FULL;
+  }
+  return 1;
 }
 
 /* for editing */
@@ -92,12 +413,22 @@ import_end()
 void
 append_normalchar(uint8_t ch)
 {
-  if (!insert(1)) {
+  append_char(&ch, 1);
+}
+
+/* one character in the len bytes of its UTF-8 sequence */
+void
+append_char(const uint8_t *src, uint8_t len)
+{
+  if (!insert(len)) {
     return;
   }
-  text[cursor ++] = ch;
-  curx += get_charwidth(ch, curx);
-  drawmode = DM_LINE;
+  for (uint8_t i = 0; i < len; i ++) {
+    ed->text[ed->cursor + i] = src[i];
+  }
+  ed->curx += get_charwidth(&ed->text[ed->cursor], ed->curx);
+  ed->cursor += len;
+  ed->drawmode = DM_LINE;
 }
 
 void
@@ -106,77 +437,322 @@ append_newline()
   if (!insert(1)) {
     return;
   }
-  drawmode = DM_BELOW;
-  text[cursor ++] = LF;
-  curx = 0;
-  cury ++;
-  if (cury >= rows) {
-    cury -= scroll_down(SCROLL_ROWS);
+  ed->drawmode = DM_BELOW;
+  ed->text[ed->cursor ++] = LF;
+  ed->curx = 0;
+  ed->cury ++;
+  if (ed->cury >= ed->rows) {
+    ed->cury -= scroll_down(SCROLL_ROWS);
   } else {
-    insert_line(cury);
+    insert_line(ed->cury);
   }
-  lines[cury] = cursor;
+  ed->lines[ed->cury] = ed->cursor;
 }
 
 void
 delete_char()
 {
-  uint8_t ch = text[cursor];
-  if (!delete(1)) {
+  uint8_t ch = ed->text[ed->cursor];
+  if (!delete(get_charlen(&ed->text[ed->cursor]))) {
     return;
   }
-  drawmode = DM_LINE;
+  ed->drawmode = DM_LINE;
   if (ch != LF) {
     return;
   }
-  if (cury == rows - 1) {
+  if (ed->cury == ed->rows - 1) {
     return;
   }
-  drawmode = DM_BELOW;
-  delete_line(cury + 1);
-  lines[rows - 1] = nextline(lines[rows - 2]);
+  ed->drawmode = DM_BELOW;
+  delete_line(ed->cury + 1);
+  ed->lines[ed->rows - 1] = nextline(ed->lines[ed->rows - 2]);
 }
 
 void
 backspace_char()
 {
-  if (cursor == 0) {
+  if (ed->cursor == 0) {
     return;
   }
-  uint8_t ch = text[cursor - 1];
-  if (ch == LF && cury == 0) {
-    cury += scroll_up(SCROLL_ROWS);
+  uint8_t ch = ed->text[ed->cursor - 1];
+  if (ch == LF && ed->cury == 0) {
+    ed->cury += scroll_up(SCROLL_ROWS);
   }
-  cursor --;
-  if (!delete(1)) {
+  offset_t end = ed->cursor;
+  ed->cursor = prev_char(end);
+  if (!delete(end - ed->cursor)) {
     return;
   }
-  drawmode = DM_LINE;
+  ed->drawmode = DM_LINE;
   if (ch == LF) {
-    cury --;
-    update_lines(cury, rows - cury, lines[cury]);
-	drawmode = DM_BELOW;
+    ed->cury --;
+    update_lines(ed->cury, ed->rows - ed->cury, ed->lines[ed->cury]);
+	ed->drawmode = DM_BELOW;
   }
-  curx = get_curx();
+  ed->curx = get_curx();
 }
 
 void
 kill_line()
 {
-  if (cursor >= numtext) {
+  if (ed->cursor >= ed->numtext) {
     return;
   }
-  uint16_t pos = cursor;
-  if (text[cursor] == LF) {
+  offset_t pos = ed->cursor;
+  if (ed->text[ed->cursor] == LF) {
 	pos ++;
 	delete_char();
 	return;
   }
-  while ((pos < numtext) && !IS_LFORNUL(text[pos])) {
+  while ((pos < ed->numtext) && !IS_LFORNUL(ed->text[pos])) {
 	pos ++;
   }
-  delete(pos - cursor);
-  drawmode = DM_LINE;
+  delete(pos - ed->cursor);
+  ed->drawmode = DM_LINE;
+}
+
+/* for editing blocks */
+
+void
+set_mark()
+{
+  ed->mark = ed->cursor;
+}
+
+void
+exchange_mark()
+{
+  if (ed->mark == NOLINE) {
+    return;
+  }
+  offset_t offset = ed->mark;
+  ed->mark = ed->cursor;
+  ed->cursor = offset;
+  locate();
+}
+
+/*
+ * Insert size bytes at the cursor with a single shift of the text after
+ * it, then rebuild the rows from the line of the insertion.
+ */
+int
+insert_text(const uint8_t *src, offset_t size)
+{
+  offset_t start = ed->cursor;
+  if (!insert(size)) {
+    return 0;
+  }
+  uint8_t *dst = &ed->text[ed->cursor];
+  while (size --) {
+    *dst++ = *src++;
+  }
+  ed->cursor = dst - ed->text;
+  reflow(start);
+  return 1;
+}
+
+void
+delete_text(offset_t start, offset_t end)
+{
+  if (start >= end) {
+    return;
+  }
+  reveal(start);
+  ed->cursor = start;
+  delete(end - start);
+  reflow(start);
+}
+
+/* copy the region, or the cursor line without one, after itself */
+void
+duplicate_region()
+{
+  offset_t start, end, extra = 0;
+  if (!get_region(&start, &end)) {
+    start = get_line_start(ed->cursor);
+    end = get_line_end(ed->cursor);
+    if (end == ed->numtext && ed->text[end - 1] != LF) {
+      extra = 1;
+    }
+  }
+  if (start >= end) {
+    return;
+  }
+  offset_t offset = ed->cursor;
+  ed->cursor = end;
+  if (!insert(end - start + extra)) {
+    ed->cursor = offset;
+    return;
+  }
+  /* the source is before the insertion, so it did not move */
+  uint8_t *dst = &ed->text[end];
+  if (extra) {
+    *dst++ = LF;
+  }
+  const uint8_t *src = &ed->text[start];
+  for (offset_t count = end - start; count --; ) {
+    *dst++ = *src++;
+  }
+  ed->mark = end + extra;
+  ed->cursor = dst - ed->text;
+  reflow(end);
+}
+
+/*
+ * Move the lines of the region, or the cursor line without one, up or
+ * down by a line. The block and its neighbour swap places by rotating
+ * them in place, so nothing outside the two is touched.
+ */
+void
+move_lines(int down)
+{
+  offset_t start, end;
+  get_block(&start, &end);
+  if (end == start || ed->text[end - 1] != LF) {
+    return;
+  }
+  offset_t top, bottom;
+  if (down) {
+    bottom = get_line_end(end);
+    if (bottom == end || ed->text[bottom - 1] != LF) {
+      return;
+    }
+    top = start;
+    rotate(top, end, bottom);
+    ed->cursor += bottom - end;
+    if (ed->mark != NOLINE) {
+      ed->mark += bottom - end;
+    }
+  } else {
+    if (start == 0) {
+      return;
+    }
+    top = get_line_start(start - 1);
+    bottom = end;
+    rotate(top, start, bottom);
+    ed->cursor -= start - top;
+    if (ed->mark != NOLINE) {
+      ed->mark -= start - top;
+    }
+  }
+  reflow(top);
+}
+
+void
+indent_lines(int dedent)
+{
+  offset_t start, end;
+  get_block(&start, &end);
+  edit_lines(start, end, dedent ? LE_DEDENT : LE_INDENT, 0);
+}
+
+/* comment out the lines, or uncomment them when all of them are comments */
+void
+comment_lines()
+{
+  offset_t start, end;
+  get_block(&start, &end);
+  uint8_t mode = LE_UNCOMMENT;
+  offset_t indent = NOLINE;
+  for (offset_t line = start; line < end; line = get_line_end(line)) {
+    offset_t offset = skip_blanks(line);
+    if (IS_LFORNUL(ed->text[offset])) {
+      continue;
+    }
+    if (ed->text[offset] != '#') {
+      mode = LE_COMMENT;
+    }
+    if (offset - line < indent) {
+      indent = offset - line;
+    }
+  }
+  if (indent == NOLINE) {
+    return;
+  }
+  edit_lines(start, end, mode, indent);
+}
+
+/*
+ * Replace [start, end) piece by piece: filter_next() hands out the input
+ * and filter_put() writes the output over the input already handed out.
+ * Until filter_end() the text has a hole between the two, and the text
+ * after it is only moved when the output overtakes the input. A filter
+ * that fails keeps the last piece as it was.
+ */
+void
+filter_start(offset_t start, offset_t end)
+{
+  reveal(start);
+  filter_from = filter_out = filter_in = filter_last = start;
+  filter_stop = end;
+}
+
+/* the next piece of at most *size bytes without splitting a character */
+const uint8_t *
+filter_next(offset_t *size)
+{
+  offset_t count = filter_stop - filter_in;
+  if (count > *size) {
+    count = *size;
+    while (count > 1 && IS_CONT(ed->text[filter_in + count])) {
+      count --;
+    }
+  }
+  const uint8_t *src = &ed->text[filter_in];
+  filter_last = filter_in;
+  filter_in += count;
+  *size = count;
+  return src;
+}
+
+/* returns 0 if the output does not fit */
+int
+filter_put(const uint8_t *src, offset_t size)
+{
+  if (size > filter_in - filter_out) {
+    offset_t added = size - (filter_in - filter_out);
+    if (!reserve(added)) {
+      return 0;
+    }
+    offset_t count = ed->numtext - filter_in;
+    const uint8_t *from = &ed->text[ed->numtext - 1];
+    uint8_t *dst = &ed->text[ed->numtext - 1 + added];
+    while (count --) {
+      *dst-- = *from--;
+    }
+    ed->numtext += added;
+    filter_in += added;
+    filter_stop += added;
+  }
+  /* the output may be the input just handed out, which is not before it */
+  uint8_t *dst = &ed->text[filter_out];
+  filter_out += size;
+  while (size --) {
+    *dst++ = *src++;
+  }
+  return 1;
+}
+
+/* close the hole, the output becomes the region */
+void
+filter_end(int done)
+{
+  if (!done) {
+    /* the output for it was not written, so it is still in place */
+    filter_in = filter_last;
+  }
+  offset_t count = ed->numtext - filter_in;
+  const uint8_t *src = &ed->text[filter_in];
+  uint8_t *dst = &ed->text[filter_out];
+  while (count --) {
+    *dst++ = *src++;
+  }
+  ed->numtext -= filter_in - filter_out;
+  set_eof();
+  ed->mark = filter_from;
+  ed->cursor = filter_out;
+  touch(filter_from);
+  reflow(filter_from);
 }
 
 /* for moving cursor */
@@ -184,104 +760,145 @@ kill_line()
 void
 move_left()
 {
-  if (cursor == 0) {
+  if (ed->cursor == 0) {
     return;
   }
-  if (text[-- cursor] == LF) {
-    if (cury == 0) {
-      cury += scroll_up(SCROLL_ROWS);
+  ed->cursor = prev_char(ed->cursor);
+  if (ed->text[ed->cursor] == LF) {
+    if (ed->cury == 0) {
+      ed->cury += scroll_up(SCROLL_ROWS);
     }
-    cury --;
+    ed->cury --;
   }
-  curx = get_curx();
+  ed->curx = get_curx();
 }
 
 void
 move_right()
 {
-  if (cursor >= numtext) {
+  if (ed->cursor >= ed->numtext) {
     return;
   }
-  uint8_t ch = text[cursor ++];
-  if (ch == LF) {
-    if (cury == rows - 1) {
-      cury -= scroll_down(SCROLL_ROWS);
+  const uint8_t *src = &ed->text[ed->cursor];
+  ed->cursor += get_charlen(src);
+  if (*src == LF) {
+    if (ed->cury == ed->rows - 1) {
+      ed->cury -= scroll_down(SCROLL_ROWS);
     }
-    cury ++;
-    curx = 0;
+    ed->cury ++;
+    ed->curx = 0;
   } else {
-    curx += get_charwidth(ch, curx);
+    ed->curx += get_charwidth(src, ed->curx);
   }
 }
 
 void
 move_up()
 {
-  if (lines[cury] == 0) {
+  if (ed->lines[ed->cury] == 0) {
     return;
   }
-  if (cury == 0) {
-    cury += scroll_up(SCROLL_ROWS);
+  if (ed->cury == 0) {
+    ed->cury += scroll_up(SCROLL_ROWS);
   }
-  cury --;
-  cursor = adjust_curx(&curx);
+  ed->cury --;
+  ed->cursor = adjust_curx(&ed->curx);
 }
 
 void
 move_down()
 {
-  uint16_t offset = nextline(lines[cury]);
+  offset_t offset = nextline(ed->lines[ed->cury]);
   if (offset == NOLINE) {
     return;
   }
-  if (cury == rows - 1) {
-    cury -= scroll_down(SCROLL_ROWS);
+  if (ed->cury == ed->rows - 1) {
+    ed->cury -= scroll_down(SCROLL_ROWS);
   }
-  cury ++;
-  cursor = adjust_curx(&curx);
+  ed->cury ++;
+  ed->cursor = adjust_curx(&ed->curx);
 }
 
 void
 move_top_of_line()
 {
-  while ((cursor > 0) && (text[cursor-1] != LF)) {
-    cursor --;
+  while ((ed->cursor > 0) && (ed->text[ed->cursor-1] != LF)) {
+    ed->cursor --;
   }
-  curx = 0;
+  ed->curx = 0;
 }
 
 void
 move_end_of_line()
 {
-  while ((cursor < numtext) && !IS_LFORNUL(text[cursor])) {
-    cursor ++;
+  while ((ed->cursor < ed->numtext) && !IS_LFORNUL(ed->text[ed->cursor])) {
+    ed->cursor ++;
   }
-  curx = get_curx();
+  ed->curx = get_curx();
 }
 
 void
 move_top_of_text()
 {
-  update_lines(0, rows, 0);
-  curx = 0;
-  cury = 0;
-  cursor = 0;
-  drawmode = DM_FULL;
+  update_lines(0, ed->rows, 0);
+  ed->curx = 0;
+  ed->cury = 0;
+  ed->cursor = 0;
+  ed->drawmode = DM_FULL;
 }
 
 void
 move_end_of_text()
 {
-  cursor = numtext;
+  ed->cursor = ed->numtext;
   move_top_of_line();
-  move_bottom(cursor);
+  move_bottom(ed->cursor);
   move_end_of_line();
 }
 
+/* any distance at once, the view follows only at the end */
+void
+move_to(offset_t offset)
+{
+  ed->cursor = offset;
+  locate();
+}
+
+/* show the end of text, returns the rows the view moved up */
+row_t
+follow_end()
+{
+  row_t delta = 0;
+  offset_t offset = ed->lines[ed->rows - 1];
+  while (offset != NOLINE && delta < ed->rows) {
+    offset = nextline(offset);
+    if (offset != NOLINE) {
+      delta ++;
+    }
+  }
+  if (delta >= ed->rows) {
+    move_end_of_text();
+    return ed->rows;
+  }
+  if (delta > 0) {
+    shift_rows(delta);
+    if (ed->drawmode < DM_BELOW) {
+      ed->drawmode = DM_BELOW;
+    }
+  }
+  ed->cursor = ed->numtext;
+  ed->cury = ed->rows - 1;
+  while (ed->cury && ed->lines[ed->cury] == NOLINE) {
+    ed->cury --;
+  }
+  ed->curx = get_curx();
+  return delta;
+}
+
 void
 do_scroll_up()
 {
-  uint16_t offset = lines[min(SCROLL_CONTEXT_ROWS - 1,cury)];
+  offset_t offset = ed->lines[min(SCROLL_CONTEXT_ROWS - 1,ed->cury)];
   if (offset == NOLINE) {
 	return;
   }
@@ -291,58 +908,249 @@ do_scroll_up()
 void
 do_scroll_down()
 {
-  uint16_t offset = lines[rows - SCROLL_CONTEXT_ROWS];
+  offset_t offset = ed->lines[ed->rows - SCROLL_CONTEXT_ROWS];
   if (offset == NOLINE) {
 	return;
   }
   setup_lines(0, offset);
-  curx = cury = 0;
-  cursor = offset;
-  drawmode = DM_FULL;
+  ed->curx = ed->cury = 0;
+  ed->cursor = offset;
+  ed->drawmode = DM_FULL;
+}
+
+void
+adjust_view()
+{
+  if (!wrapmode) {
+    adjust_leftcol();
+    return;
+  }
+  ed->leftcol = 0;
+  if (ed->wrap_from != NOLINE) {
+    rewrap();
+    ed->wrap_from = NOLINE;
+  }
+  while (ed->cursor < ed->lines[ed->cury]) {
+    if (ed->cury == 0) {
+      row_t delta = scroll_up(SCROLL_ROWS);
+      if (delta == 0) {
+        break;
+      }
+      ed->cury += delta;
+    }
+    ed->cury --;
+  }
+  while (1) {
+    offset_t next = (ed->cury < ed->rows - 1) ? ed->lines[ed->cury + 1] : nextline(ed->lines[ed->cury]);
+    if (next == NOLINE || ed->cursor < next) {
+      break;
+    }
+    if (ed->cury == ed->rows - 1) {
+      ed->cury -= scroll_down(SCROLL_ROWS);
+    }
+    ed->cury ++;
+  }
+  ed->curx = get_curx();
+}
+
+void
+adjust_leftcol()
+{
+  col_t half = ed->columns / 2;
+  if (ed->curx >= ed->leftcol && ed->curx - ed->leftcol < ed->columns) {
+    return;
+  }
+  if (ed->curx < ed->columns - 1) {
+    ed->leftcol = 0;
+  } else if (ed->curx < ed->leftcol) {
+    ed->leftcol = ed->curx > half ? ed->curx - half : 0;
+  } else {
+    ed->leftcol = ed->curx - half;
+  }
+  ed->drawmode = DM_FULL;
 }
 
 /* for query */
 
 const uint8_t *
-get_top_of_line(uint8_t y)
+get_top_of_line(row_t y)
 {
-  uint16_t offset = lines[y];
+  offset_t offset = ed->lines[y];
   if (offset == NOLINE) {
     return NULL;
   }
-  return &text[offset];
+  return &ed->text[offset];
 }
 
-uint8_t
-get_charwidth(uint8_t ch, uint8_t pos)
+int
+get_region(offset_t *start, offset_t *end)
 {
-  if (ch == TAB) {
-    return tabwidth - (pos % tabwidth);
-  } else if (ch < ' ') {
+  if (ed->mark == NOLINE) {
     return 0;
   }
+  *start = min(ed->mark, ed->cursor);
+  *end = (ed->mark > ed->cursor) ? ed->mark : ed->cursor;
   return 1;
 }
 
-/* for debugging, to be removed */
+offset_t
+get_line_start(offset_t offset)
+{
+  while ((offset > 0) && (ed->text[offset-1] != LF)) {
+    offset --;
+  }
+  return offset;
+}
+
+/* just after the LF ending the line at offset */
+offset_t
+get_line_end(offset_t offset)
+{
+  while ((offset < ed->numtext) && (ed->text[offset] != LF)) {
+    offset ++;
+  }
+  return (offset < ed->numtext) ? offset + 1 : offset;
+}
+
+/* the end of the next word after offset */
+offset_t
+get_word_end(offset_t offset)
+{
+  while (offset < ed->numtext && !IS_WORD(ed->text[offset])) {
+    offset ++;
+  }
+  while (offset < ed->numtext && IS_WORD(ed->text[offset])) {
+    offset ++;
+  }
+  return offset;
+}
+
+/* the start of the word before offset */
+offset_t
+get_word_start(offset_t offset)
+{
+  while (offset > 0 && !IS_WORD(ed->text[offset - 1])) {
+    offset --;
+  }
+  while (offset > 0 && IS_WORD(ed->text[offset - 1])) {
+    offset --;
+  }
+  return offset;
+}
+
+/* the blank line after the paragraph at or after offset, or the end */
+offset_t
+get_paragraph_end(offset_t offset)
+{
+  offset_t line = get_line_start(offset);
+  while (line < ed->numtext && is_blank_line(line)) {
+    line = get_line_end(line);
+  }
+  while (line < ed->numtext && !is_blank_line(line)) {
+    line = get_line_end(line);
+  }
+  return line;
+}
+
+/* the blank line before the paragraph before offset, or the top */
+offset_t
+get_paragraph_start(offset_t offset)
+{
+  offset_t line = get_line_start(offset);
+  while (line > 0 && is_blank_line(line)) {
+    line = get_line_start(line - 1);
+  }
+  while (line > 0 && !is_blank_line(line)) {
+    line = get_line_start(line - 1);
+  }
+  return line;
+}
+
+/* number of the logical line that row y is part of, from 1 */
+offset_t
+get_line_number(row_t y)
+{
+  offset_t number = ed->topline + 1;
+  if (!wrapmode) {
+    return number + y;
+  }
+  for (row_t i = 1; i <= y; i ++) {
+    if (ed->lines[i] != NOLINE && ed->text[ed->lines[i] - 1] == LF) {
+      number ++;
+    }
+  }
+  return number;
+}
+
+/*
+ * Text is UTF-8. A character takes the bytes of its sequence; a byte
+ * that does not start a whole sequence is a character of its own, shown
+ * as '?'. East Asian wide characters take two columns.
+ */
+
+static const uint32_t wide_ranges[][2] = {
+  { 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF },
+  { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+  { 0xFE30, 0xFE4F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F },
+  { 0x1F900, 0x1F9FF }, { 0x20000, 0x3FFFD },
+};
+
+uint8_t
+get_charlen(const uint8_t *src)
+{
+  uint8_t ch = *src;
+  uint8_t len = (ch >= 0xF8) ? 1 : (ch >= 0xF0) ? 4 : (ch >= 0xE0) ? 3 : (ch >= 0xC0) ? 2 : 1;
+  for (uint8_t i = 1; i < len; i ++) {
+    if (!IS_CONT(src[i])) {
+      return 1;
+    }
+  }
+  return len;
+}
+
+uint8_t
+get_charwidth(const uint8_t *src, col_t pos)
+{
+  uint8_t ch = *src;
+  if (ch == TAB) {
+    return tabwidth - (pos % tabwidth);
+  } else if (ch < ' ') {
+    return 0;
+  } else if (ch < 0xE1) {
+    return 1;
+  }
+  uint8_t len = get_charlen(src);
+  if (len < 3) {
+    return 1;
+  }
+  uint32_t code = decode(src, len);
+  for (size_t i = 0; i < sizeof wide_ranges / sizeof wide_ranges[0]; i ++) {
+    if (code >= wide_ranges[i][0] && code <= wide_ranges[i][1]) {
+      return 2;
+    }
+  }
+  return 1;
+}
+
+/* for debugging, to be removed */
 
 void
 print_status()
 {
-  printf("maxtext=%d, numtext=%d, curx=%d, cury=%d, cursor=%d\n",
-         maxtext, numtext, curx, cury, cursor);
+  printf("maxtext=%lu, numtext=%lu, curx=%d, cury=%d, cursor=%lu\n",
+         (unsigned long) ed->maxtext, (unsigned long) ed->numtext, ed->curx, ed->cury, (unsigned long) ed->cursor);
 }
 
 void
 print_lines()
 {
-  for (int i = 0; i < rows; i ++) {
-	uint16_t offset = lines[i];
+  for (int i = 0; i < ed->rows; i ++) {
+	offset_t offset = ed->lines[i];
 	const uint8_t *src = (const uint8_t *) "";
 	if (offset != NOLINE) {
-	  src = &text[offset];
+	  src = &ed->text[offset];
 	}
-    printf("%2d %d (%2.2s)\n", i, offset, src);
+    printf("%2d %lu (%2.2s)\n", i, (unsigned long) offset, src);
   }
 }
 
@@ -351,74 +1159,349 @@ print_lines()
 static void
 set_eof()
 {
-  text[numtext] = NUL;
+  ed->text[ed->numtext] = NUL;
 }
 
 static void
-setup_lines(uint8_t start, uint16_t offset)
+setup_lines(row_t start, offset_t offset)
 {
-  uint8_t count = rows - start;
+  row_t count = ed->rows - start;
   if (count == 0) {
     return;
   }
-  while ((offset > 0) && (text[offset-1] != LF)) {
-    offset --;
+  update_lines(start, count, row_start(offset));
+}
+
+static int
+reserve(offset_t added)
+{
+  if ((ed->numtext + added) < ed->maxtext) {
+    return 1;
+  }
+  if (resize_func == NULL) {
+    return 0;
+  }
+  uint32_t size = (uint32_t) ed->numtext + added + 2 + BUFFER_CHUNK;
+  size -= size % BUFFER_CHUNK;
+  if (size > MAX_TEXT) {
+    size = MAX_TEXT;
+  }
+  if (size < (uint32_t) ed->numtext + added + 3) {
+    return 0;
+  }
+  return resize(size);
+}
+
+static int
+resize(offset_t size)
+{
+  uint8_t *p = (*resize_func)(&size);
+  if (p == NULL) {
+    return 0;
   }
-  update_lines(start, count, offset);
+  ed->text = p;
+  ed->maxtext = size - 2;
+  return 1;
 }
 
 static int
-insert(uint16_t added)
+insert(offset_t added)
 {
-  if ((added == 0) || ((numtext + added) >= maxtext)) {
+  if ((added == 0) || !reserve(added)) {
     return 0;
   }
-  modified = 1;
-  uint16_t count = numtext - cursor;
-  const uint8_t *src = &text[numtext-1];
-  numtext += added;
-  uint8_t *dst = &text[numtext-1];
+  offset_t count = ed->numtext - ed->cursor;
+  const uint8_t *src = &ed->text[ed->numtext-1];
+  ed->numtext += added;
+  uint8_t *dst = &ed->text[ed->numtext-1];
   while (count --) {
     *dst-- = *src--;
   }
   set_eof();
-  for (int i = cury + 1; i < rows; i ++) {
-    if (lines[i] != NOLINE) {
-      lines[i] += added;
+  for (int i = 0; i < ed->rows; i ++) {
+    if (ed->lines[i] != NOLINE && ed->lines[i] > ed->cursor) {
+      ed->lines[i] += added;
     }
   }
+  if (ed->mark != NOLINE && ed->mark > ed->cursor) {
+    ed->mark += added;
+  }
+  touch(ed->cursor);
   return 1;
 }
 
 static int
-delete(uint16_t removed)
+delete(offset_t removed)
 {
-  if (cursor >= numtext) {
+  if (ed->cursor >= ed->numtext) {
     return 0;
   }
-  modified = 1;
-  uint16_t count = numtext - cursor - removed;
-  const uint8_t *src = &text[cursor + removed];
-  uint8_t *dst = &text[cursor];
+  offset_t count = ed->numtext - ed->cursor - removed;
+  const uint8_t *src = &ed->text[ed->cursor + removed];
+  uint8_t *dst = &ed->text[ed->cursor];
   while (count --) {
     *dst++ = *src++;
   }
-  numtext -= removed;
+  ed->numtext -= removed;
   set_eof();
-  for (int i = cury + 1; i < rows; i ++) {
-    if (lines[i] != NOLINE) {
-      lines[i] -= removed;
+  for (int i = 0; i < ed->rows; i ++) {
+    if (ed->lines[i] != NOLINE && ed->lines[i] > ed->cursor) {
+      ed->lines[i] = (ed->lines[i] > ed->cursor + removed) ? ed->lines[i] - removed : ed->cursor;
     }
   }
+  if (ed->mark != NOLINE && ed->mark > ed->cursor) {
+    ed->mark = (ed->mark > ed->cursor + removed) ? ed->mark - removed : ed->cursor;
+  }
+  touch(ed->cursor);
   return 1;
 }
 
+/* the text changed from offset */
+static void
+touch(offset_t offset)
+{
+  ed->modified = 1;
+  colmap_truncate(offset);
+  if (wrapmode && offset < ed->wrap_from) {
+    ed->wrap_from = offset;
+  }
+  if (offset < ed->dirty_from) {
+    ed->dirty_from = offset;
+  }
+  if (change_func != NULL) {
+    (*change_func)(offset);
+  }
+}
+
+/* make sure the view does not start after offset */
+static void
+reveal(offset_t offset)
+{
+  if (offset >= ed->lines[0]) {
+    return;
+  }
+  update_lines(0, ed->rows, row_start(offset));
+  ed->drawmode = DM_FULL;
+}
+
+/*
+ * Rebuild the rows after a block edit at offset, which must not be above
+ * the view, from the start of its line, then bring the cursor into view.
+ */
+static void
+reflow(offset_t offset)
+{
+  row_t y = ed->rows - 1;
+  while (y > 0 && (ed->lines[y] == NOLINE || ed->lines[y] >= offset)) {
+    y --;
+  }
+  while (y > 0 && ed->lines[y] > 0 && ed->text[ed->lines[y]-1] != LF) {
+    y --;
+  }
+  if (y == 0) {
+    ed->lines[0] = row_start(ed->lines[0]);
+  }
+  update_lines(y, ed->rows - y, ed->lines[y]);
+  if (ed->drawmode < DM_BELOW) {
+    ed->drawmode = DM_BELOW;
+  }
+  locate();
+}
+
+/* find the row of the cursor, scrolling when it is out of the view */
+static void
+locate()
+{
+  offset_t next = nextline(ed->lines[ed->rows - 1]);
+  if (ed->cursor < ed->lines[0]) {
+    update_lines(0, ed->rows, row_start(ed->cursor));
+    ed->drawmode = DM_FULL;
+  } else if (next != NOLINE && ed->cursor >= next) {
+    offset_t offset = ed->cursor;
+    move_bottom(row_start(offset));
+    ed->cursor = offset;
+  }
+  ed->cury = ed->rows - 1;
+  while (ed->cury > 0 && (ed->lines[ed->cury] == NOLINE || ed->lines[ed->cury] > ed->cursor)) {
+    ed->cury --;
+  }
+  ed->curx = get_curx();
+}
+
+/* swap [start, middle) and [middle, end) in place */
+static void
+rotate(offset_t start, offset_t middle, offset_t end)
+{
+  reveal(start);
+  reverse(start, middle);
+  reverse(middle, end);
+  reverse(start, end);
+  touch(start);
+}
+
+/* the whole lines of the region, or the cursor line without one */
+static void
+get_block(offset_t *start, offset_t *end)
+{
+  if (!get_region(start, end)) {
+    *start = *end = ed->cursor;
+  }
+  *start = get_line_start(*start);
+  if (*end == *start || ed->text[*end - 1] != LF) {
+    *end = get_line_end(*end);
+  }
+}
+
+/*
+ * Change every line in [start, end) in a single pass over the text after
+ * start. A first pass sizes the change; the text is then rewritten from
+ * the end when it grows and from the start when it shrinks, so the tail
+ * moves once however many lines there are.
+ */
+static void
+edit_lines(offset_t start, offset_t end, uint8_t mode, offset_t indent)
+{
+  const uint8_t *prefix = (mode == LE_COMMENT) ? (const uint8_t *) "# " : spaces;
+  uint8_t grows = (mode == LE_INDENT || mode == LE_COMMENT);
+  offset_t total = 0, size, at;
+  offset_t cursor_to = ed->cursor, mark_to = ed->mark;
+  for (offset_t line = start; line < end; line = get_line_end(line)) {
+    size = line_change(line, mode, indent, &at);
+    total += size;
+    follow_change(&cursor_to, ed->cursor, at, size, grows);
+    follow_change(&mark_to, ed->mark, at, size, grows);
+  }
+  if (total == 0 || (grows && !reserve(total))) {
+    return;
+  }
+  reveal(start);
+  if (grows) {
+    const uint8_t *src = &ed->text[ed->numtext];
+    uint8_t *dst = &ed->text[ed->numtext + total];
+    while (src > &ed->text[end]) {
+      *--dst = *--src;
+    }
+    for (offset_t line = end; line > start; ) {
+      line = get_line_start(line - 1);
+      size = line_change(line, mode, indent, &at);
+      while (src > &ed->text[at]) {
+        *--dst = *--src;
+      }
+      while (size --) {
+        *--dst = prefix[size];
+      }
+      while (src > &ed->text[line]) {
+        *--dst = *--src;
+      }
+    }
+    ed->numtext += total;
+  } else {
+    const uint8_t *src = &ed->text[start];
+    uint8_t *dst = &ed->text[start];
+    for (offset_t line = start; line < end; ) {
+      offset_t next = get_line_end(line);
+      size = line_change(line, mode, indent, &at);
+      while (src < &ed->text[at]) {
+        *dst++ = *src++;
+      }
+      src += size;
+      while (src < &ed->text[next]) {
+        *dst++ = *src++;
+      }
+      line = next;
+    }
+    while (src < &ed->text[ed->numtext]) {
+      *dst++ = *src++;
+    }
+    ed->numtext -= total;
+  }
+  set_eof();
+  ed->cursor = cursor_to;
+  ed->mark = mark_to;
+  touch(start);
+  reflow(start);
+}
+
+/* bytes edit_lines() adds or removes at *at in the line, blank ones are kept */
+static offset_t
+line_change(offset_t line, uint8_t mode, offset_t indent, offset_t *at)
+{
+  offset_t offset = skip_blanks(line);
+  offset_t size = 0;
+  *at = line;
+  if (IS_LFORNUL(ed->text[offset])) {
+    return 0;
+  }
+  switch (mode) {
+  case LE_INDENT:
+    return tabwidth;
+  case LE_DEDENT:
+    if (ed->text[line] == TAB) {
+      return 1;
+    }
+    while (size < tabwidth && ed->text[line + size] == ' ') {
+      size ++;
+    }
+    return size;
+  case LE_COMMENT:
+    *at = line + indent;
+    return 2;
+  default:
+    if (ed->text[offset] != '#') {
+      return 0;
+    }
+    *at = offset;
+    return (ed->text[offset + 1] == ' ') ? 2 : 1;
+  }
+}
+
+/* where offset goes when size bytes are added or removed at at */
 static void
-insert_line(uint8_t line)
+follow_change(offset_t *to, offset_t offset, offset_t at, offset_t size, uint8_t grows)
+{
+  if (offset == NOLINE || offset < at) {
+    return;
+  }
+  if (grows) {
+    *to += size;
+  } else {
+    *to -= min(offset - at, size);
+  }
+}
+
+static offset_t
+skip_blanks(offset_t offset)
 {
-  uint8_t count = rows - line - 1;
-  const uint16_t *src = &lines[rows - 2];
-  uint16_t *dst = &lines[rows - 1];
+  while (char_class[ed->text[offset]] == CC_BLANK) {
+    offset ++;
+  }
+  return offset;
+}
+
+static int
+is_blank_line(offset_t line)
+{
+  return IS_LFORNUL(ed->text[skip_blanks(line)]);
+}
+
+static void
+reverse(offset_t start, offset_t end)
+{
+  uint8_t *head = &ed->text[start];
+  uint8_t *tail = &ed->text[end];
+  while (head < -- tail) {
+    uint8_t ch = *head;
+    *head++ = *tail;
+    *tail = ch;
+  }
+}
+
+static void
+insert_line(row_t line)
+{
+  row_t count = ed->rows - line - 1;
+  const offset_t *src = &ed->lines[ed->rows - 2];
+  offset_t *dst = &ed->lines[ed->rows - 1];
 
   while (count --) {
     *dst-- = *src--;
@@ -426,11 +1509,11 @@ insert_line(uint8_t line)
 }
 
 static void
-delete_line(uint8_t line)
+delete_line(row_t line)
 {
-  uint8_t count = rows - line - 1;
-  const uint16_t *src = &lines[line + 1];
-  uint16_t *dst = &lines[line];
+  row_t count = ed->rows - line - 1;
+  const offset_t *src = &ed->lines[line + 1];
+  offset_t *dst = &ed->lines[line];
 
   while (count --) {
     *dst++ = *src++;
@@ -438,12 +1521,15 @@ delete_line(uint8_t line)
 }
 
 static void
-update_lines(uint8_t line, uint8_t count, uint16_t offset)
+update_lines(row_t line, row_t count, offset_t offset)
 {
-  uint16_t *dst = &lines[line];
+  if (line == 0) {
+    move_top(offset);
+  }
+  offset_t *dst = &ed->lines[line];
 
   while (count --) {
-    if (offset > numtext) {
+    if (offset > ed->numtext) {
       do {
         *dst++ = NOLINE;
       } while (count --);
@@ -454,11 +1540,38 @@ update_lines(uint8_t line, uint8_t count, uint16_t offset)
   }
 }
 
+/* keep topline while lines[0] moves to offset */
+static void
+move_top(offset_t offset)
+{
+  if (offset == NOLINE || offset == ed->lines[0]) {
+    return;
+  }
+  if (offset > ed->lines[0]) {
+    ed->topline += count_lf(ed->lines[0], offset);
+  } else {
+    ed->topline -= count_lf(offset, ed->lines[0]);
+  }
+}
+
+static offset_t
+count_lf(offset_t from, offset_t to)
+{
+  offset_t count = 0;
+  const uint8_t *src = &ed->text[from];
+  while (from ++ < to) {
+    if (*src++ == LF) {
+      count ++;
+    }
+  }
+  return count;
+}
+
 static int
-scroll_up(uint8_t _delta)
+scroll_up(row_t _delta)
 {
-  uint8_t delta;
-  uint16_t offset = lines[0];
+  row_t delta;
+  offset_t offset = ed->lines[0];
   for (delta = 0; delta < _delta; delta ++) {
     if (offset == 0) {
       break;
@@ -468,108 +1581,373 @@ scroll_up(uint8_t _delta)
   if (delta == 0) {
     return 0;
   }
-  uint8_t count = rows - delta;
-  const uint16_t *src = &lines[rows - 1 - delta];
-  uint16_t *dst = &lines[rows - 1];
+  row_t count = ed->rows - delta;
+  const offset_t *src = &ed->lines[ed->rows - 1 - delta];
+  offset_t *dst = &ed->lines[ed->rows - 1];
   while (count --) {
     *dst-- = *src--;
   }
   update_lines(0, delta, offset);
-  drawmode = DM_FULL;
+  ed->drawmode = DM_FULL;
   return delta;
 }
 
 static int
-scroll_down(uint8_t delta)
+scroll_down(row_t delta)
 {
   if (delta == 0) {
     return 0;
   }
-  uint8_t count = rows - delta;
-  const uint16_t *src = &lines[delta];
-  uint16_t *dst = &lines[0];
+  shift_rows(delta);
+  ed->drawmode = DM_FULL;
+  return delta;
+}
+
+static void
+shift_rows(row_t delta)
+{
+  move_top(ed->lines[delta]);
+  row_t count = ed->rows - delta;
+  const offset_t *src = &ed->lines[delta];
+  offset_t *dst = &ed->lines[0];
   while (count --) {
     *dst++ = *src++;
   }
-  uint16_t offset = nextline(*(src-1));
-  update_lines(rows - delta, delta, offset);
-  drawmode = DM_FULL;
-  return delta;
+  offset_t offset = nextline(*(src-1));
+  update_lines(ed->rows - delta, delta, offset);
+}
+
+/* drop the oldest lines, returns the bytes dropped */
+static offset_t
+drop_head()
+{
+  offset_t end = ed->maxtext / 4;
+  if (end == 0 || end > ed->numtext) {
+    return 0;
+  }
+  offset_t top = end;
+  while (top < ed->numtext && ed->text[top - 1] != LF) {
+    top ++;
+  }
+  if (top < ed->numtext) {
+    end = top;
+  }
+  cut_head(end);
+  if (change_func != NULL) {
+    (*change_func)(0);
+  }
+  return end;
+}
+
+static offset_t
+cut_offset(offset_t offset, offset_t end)
+{
+  return (offset > end) ? offset - end : 0;
 }
 
 static void
-move_bottom(uint16_t offset)
+move_bottom(offset_t offset)
 {
-  uint8_t count = rows - 1;
+  row_t count = ed->rows - 1;
   while (count --) {
 	offset = prevline(offset);
   }
-  update_lines(0, rows, offset);
-  curx = 0;
-  cury = rows - 1;
-  while (cury && lines[cury] == NOLINE) {
-	cury --;
+  update_lines(0, ed->rows, offset);
+  ed->curx = 0;
+  ed->cury = ed->rows - 1;
+  while (ed->cury && ed->lines[ed->cury] == NOLINE) {
+	ed->cury --;
   }
-  cursor = lines[cury];
-  drawmode = DM_FULL;
+  ed->cursor = ed->lines[ed->cury];
+  ed->drawmode = DM_FULL;
 }
 
-static uint16_t
-prevline(uint16_t offset)
+static offset_t
+prevline(offset_t offset)
 {
   if (offset == 0) {
     return offset;
   }
-  offset --;
-  while ((offset > 0) && (text[offset-1] != LF)) {
-    offset --;
-  }
-  return offset;
+  return row_start(offset - 1);
 }
 
-static uint16_t
-nextline(uint16_t offset)
+static offset_t
+nextline(offset_t offset)
 {
   if (offset == NOLINE) {
     return offset;
   }
-  while (!IS_LFORNUL(text[offset])) {
-    offset ++;
+  uint32_t pos = 0;
+  while (!IS_LFORNUL(ed->text[offset])) {
+    if (wrapmode) {
+      uint8_t w = get_charwidth(&ed->text[offset], pos);
+      if (pos > 0 && pos + w > (uint32_t) ed->columns - 1) {
+        return offset;
+      }
+      pos += w;
+    }
+    offset += get_charlen(&ed->text[offset]);
   }
   offset ++;
-  if (offset > numtext) {
+  if (offset > ed->numtext) {
     return NOLINE;
   }
   return offset;
 }
 
-static uint8_t
+/* start of the character before offset */
+static offset_t
+prev_char(offset_t offset)
+{
+  offset_t start = offset - 1;
+  while (start > 0 && offset - start < 4 && IS_CONT(ed->text[start])) {
+    start --;
+  }
+  return (get_charlen(&ed->text[start]) == offset - start) ? start : offset - 1;
+}
+
+static uint32_t
+decode(const uint8_t *src, uint8_t len)
+{
+  uint32_t code = src[0] & (0x7F >> len);
+  for (uint8_t i = 1; i < len; i ++) {
+    code = (code << 6) | (src[i] & 0x3F);
+  }
+  return code;
+}
+
+/* start of the screen row containing offset */
+static offset_t
+row_start(offset_t offset)
+{
+  offset_t top = offset;
+  while ((top > 0) && (ed->text[top-1] != LF)) {
+    top --;
+  }
+  if (!wrapmode) {
+    return top;
+  }
+  while (1) {
+    offset_t next = nextline(top);
+    if (next == NOLINE || next > offset) {
+      return top;
+    }
+    top = next;
+  }
+}
+
+/*
+ * Recompute the wrapped rows of the lines touched since wrap_from. Rows
+ * below them were already shifted by insert()/delete(), so the walk stops
+ * at the first row after the cursor line that lands where it was.
+ */
+static void
+rewrap()
+{
+  row_t y = ed->rows - 1;
+  while (y > 0 && (ed->lines[y] == NOLINE || ed->lines[y] >= ed->wrap_from)) {
+    y --;
+  }
+  while (y > 0 && ed->lines[y] > 0 && ed->text[ed->lines[y]-1] != LF) {
+    y --;
+  }
+  if (y == 0) {
+    ed->lines[0] = row_start(ed->lines[0]);
+  }
+  offset_t eol = ed->cursor > ed->wrap_from ? ed->cursor : ed->wrap_from;
+  while ((eol < ed->numtext) && (ed->text[eol] != LF)) {
+    eol ++;
+  }
+  for (; y < ed->rows - 1; y ++) {
+    offset_t next = nextline(ed->lines[y]);
+    if (next == ed->lines[y + 1] && next != NOLINE && next > eol) {
+      break;
+    }
+    if (next != ed->lines[y + 1] && ed->drawmode < DM_BELOW) {
+      ed->drawmode = DM_BELOW;
+    }
+    ed->lines[y + 1] = next;
+  }
+}
+
+static col_t
 get_curx()
 {
-  uint16_t top = lines[cury];
-  uint16_t count = cursor - top;
-  const uint8_t *src = &text[top];
-  uint8_t pos = 0;
+  return column_of(ed->cursor);
+}
 
-  while (count --) {
-    pos += get_charwidth(*src++, pos);
+static col_t
+column_of(offset_t offset)
+{
+  colmap_sync();
+  colmap_extend(offset, MAX_COLUMNS);
+  if (offset > ed->colmap_end) {
+    /* the map is full: count the rest of the way */
+    offset_t at = ed->colmap_end;
+    col_t pos = ed->colmap_endx;
+    while (at < offset) {
+      pos += get_charwidth(&ed->text[at], pos);
+      at += get_charlen(&ed->text[at]);
+    }
+    return pos;
   }
-  return pos;
+  for (int i = ed->colmap_count; i -- > 0; ) {
+    if (ed->colmap_offset[i] <= offset) {
+      return ed->colmap_x[i] + (offset - ed->colmap_offset[i]);
+    }
+    offset_t start = ed->colmap_offset[i] - ed->colmap_run[i] * ed->colmap_len[i];
+    if (start <= offset) {
+      /* inside a run */
+      offset_t count = ed->colmap_run[i] - (offset - start) / ed->colmap_len[i];
+      return ed->colmap_x[i] - count * ed->colmap_width[i];
+    }
+  }
+  return offset - ed->colmap_top;
 }
 
-static uint16_t
-adjust_curx(uint8_t *org)
+static offset_t
+adjust_curx(col_t *org)
 {
-  uint8_t pos = 0, ch, w;
-  uint16_t offset = lines[cury];
-  while ((offset < numtext) && ((ch = text[offset]) != LF)) {
-    w = get_charwidth(ch, pos);
+  offset_t offset = find_curx(org);
+  if (wrapmode) {
+    offset_t next = nextline(ed->lines[ed->cury]);
+    if (next != NOLINE && offset >= next) {
+      offset = prev_char(next);
+      *org = column_of(offset);
+    }
+  }
+  return offset;
+}
+
+static offset_t
+find_curx(col_t *org)
+{
+  colmap_sync();
+  colmap_extend(NOLINE, *org);
+  offset_t base = ed->colmap_top;
+  col_t pos = 0;
+  for (int i = 0; i < ed->colmap_count; i ++) {
+    offset_t offset = ed->colmap_offset[i] - ed->colmap_run[i] * ed->colmap_len[i];
+    col_t start = pos + (offset - base);
+    if (*org < start) {
+      break;
+    }
+    if (*org < ed->colmap_x[i]) {
+      /* at the start of the character under org */
+      col_t count = ed->colmap_width[i] ? (*org - start) / ed->colmap_width[i] : 0;
+      *org = start + count * ed->colmap_width[i];
+      return offset + count * ed->colmap_len[i];
+    }
+    base = ed->colmap_offset[i];
+    pos = ed->colmap_x[i];
+  }
+  if (*org < ed->colmap_endx) {
+    return base + (*org - pos);
+  }
+  if (ed->colmap_eol) {
+    *org = ed->colmap_endx;
+    return ed->colmap_end;
+  }
+  /* the map is full: scan the rest of the way */
+  uint8_t w;
+  offset_t offset = ed->colmap_end;
+  pos = ed->colmap_endx;
+  while ((offset < ed->numtext) && (ed->text[offset] != LF)) {
+    w = get_charwidth(&ed->text[offset], pos);
     if (pos + w > *org) {
       break;
     }
     pos += w;
-    offset ++;
+    offset += get_charlen(&ed->text[offset]);
   }
   *org = pos;
   return offset;
 }
+
+/*
+ * The column map caches the display columns of the cursor line. Only
+ * characters that are not one byte and one column (tabs, UTF-8) get an
+ * entry, and a run of alike ones next to each other shares one: it holds
+ * the offset and the column just after the run, its length and the
+ * bytes and width of each character. Any other position is derived from
+ * the nearest entry before it. The map is built lazily up to colmap_end
+ * and truncated at the cursor when the line is edited.
+ */
+
+static void
+colmap_sync()
+{
+  if (ed->colmap_top == ed->lines[ed->cury]) {
+    return;
+  }
+  ed->colmap_top = ed->colmap_end = ed->lines[ed->cury];
+  ed->colmap_endx = 0;
+  ed->colmap_count = 0;
+  ed->colmap_eol = 0;
+}
+
+static void
+colmap_extend(offset_t offset, col_t x)
+{
+  while (ed->colmap_end < offset && ed->colmap_endx <= x && !ed->colmap_eol) {
+    const uint8_t *src = &ed->text[ed->colmap_end];
+    if (ed->colmap_end >= ed->numtext || *src == LF) {
+      ed->colmap_eol = 1;
+      break;
+    }
+    uint8_t len = get_charlen(src);
+    uint8_t w = get_charwidth(src, ed->colmap_endx);
+    if (len != 1 || w != 1) {
+      int last = ed->colmap_count - 1;
+      if (last >= 0 && ed->colmap_offset[last] == ed->colmap_end && ed->colmap_run[last] < UINT8_MAX
+          && ed->colmap_len[last] == len && ed->colmap_width[last] == w) {
+        ed->colmap_run[last] ++;
+      } else if (ed->colmap_count == COLMAP_SIZE) {
+        break;
+      } else {
+        last = ed->colmap_count ++;
+        ed->colmap_run[last] = 1;
+        ed->colmap_len[last] = len;
+        ed->colmap_width[last] = w;
+      }
+      ed->colmap_offset[last] = ed->colmap_end + len;
+      ed->colmap_x[last] = ed->colmap_endx + w;
+    }
+    ed->colmap_end += len;
+    ed->colmap_endx += w;
+  }
+}
+
+static void
+colmap_truncate(offset_t offset)
+{
+  if (ed->colmap_top == NOLINE || offset < ed->colmap_top) {
+    ed->colmap_top = NOLINE;
+    return;
+  }
+  if (offset >= ed->colmap_end) {
+    return;
+  }
+  while (ed->colmap_count > 0 && ed->colmap_offset[ed->colmap_count - 1] > offset) {
+    int last = ed->colmap_count - 1;
+    offset_t start = ed->colmap_offset[last] - ed->colmap_run[last] * ed->colmap_len[last];
+    if (start >= offset) {
+      ed->colmap_count --;
+      continue;
+    }
+    /* keep the part of the run before offset */
+    uint8_t keep = (offset - start) / ed->colmap_len[last];
+    if (keep == 0) {
+      ed->colmap_count --;
+      continue;
+    }
+    uint8_t count = ed->colmap_run[last] - keep;
+    ed->colmap_run[last] = keep;
+    ed->colmap_offset[last] -= count * ed->colmap_len[last];
+    ed->colmap_x[last] -= count * ed->colmap_width[last];
+    break;
+  }
+  ed->colmap_end = ed->colmap_count ? ed->colmap_offset[ed->colmap_count - 1] : ed->colmap_top;
+  ed->colmap_endx = ed->colmap_count ? ed->colmap_x[ed->colmap_count - 1] : 0;
+  ed->colmap_eol = 0;
+}
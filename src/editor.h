@@ -1,5 +1,49 @@
-#define MAX_ROWS			25
+#ifndef __EDITOR_H
+#define __EDITOR_H
+
+#include <stdint.h>
+
+#ifndef MODEDITOR_OFFSET_BITS
+#define MODEDITOR_OFFSET_BITS	16
+#endif
+#ifndef MODEDITOR_COLUMN_BITS
+#define MODEDITOR_COLUMN_BITS	16
+#endif
+#ifndef MODEDITOR_MAX_ROWS
+#define MODEDITOR_MAX_ROWS		255
+#endif
+
+#if MODEDITOR_OFFSET_BITS == 32
+typedef uint32_t offset_t;
+#define NOLINE				0xFFFFFFFF
+#elif MODEDITOR_OFFSET_BITS == 16
+typedef uint16_t offset_t;
+#define NOLINE				0xFFFF
+#else
+#error "MODEDITOR_OFFSET_BITS must be 16 or 32"
+#endif
+
+#if MODEDITOR_COLUMN_BITS == 16
+typedef uint16_t col_t;
+#define MAX_COLUMNS			0xFFFF
+#elif MODEDITOR_COLUMN_BITS == 8
+typedef uint8_t col_t;
+#define MAX_COLUMNS			0xFF
+#else
+#error "MODEDITOR_COLUMN_BITS must be 8 or 16"
+#endif
+
+#if MODEDITOR_MAX_ROWS < 256
+typedef uint8_t row_t;
+#else
+typedef uint16_t row_t;
+#endif
+
+#define MAX_TEXT			NOLINE
+#define MAX_ROWS			MODEDITOR_MAX_ROWS
 #define SCROLL_CONTEXT_ROWS 2
+#define BUFFER_CHUNK		512
+#define COLMAP_SIZE			16
 
 #define TAB					'\t'
 #define LF					'\n'
@@ -11,21 +55,79 @@ enum DrawMode {
   DM_NONE = 0, DM_LINE, DM_BELOW, DM_FULL
 };
 
+/*
+ * The state of one buffer and of its view. The functions below work on
+ * the context selected with select_editor(), so several buffers can stay
+ * in memory and be switched without copying.
+ */
+typedef struct {
+  uint8_t *text;
+  offset_t maxtext, numtext;
+  offset_t *lines;
+  row_t rows;
+  col_t columns;
+  col_t leftcol;
+  offset_t topline;
+  offset_t dirty_from;
+  offset_t saved_size;
+  offset_t cursor;
+  offset_t mark;
+  col_t curx;
+  row_t cury;
+  uint8_t modified;
+  enum DrawMode drawmode;
+  offset_t wrap_from;
+  /* display columns of the cursor line */
+  offset_t colmap_top, colmap_end;
+  col_t colmap_endx;
+  uint8_t colmap_count, colmap_eol;
+  offset_t colmap_offset[COLMAP_SIZE];
+  col_t colmap_x[COLMAP_SIZE];
+  uint8_t colmap_run[COLMAP_SIZE], colmap_len[COLMAP_SIZE], colmap_width[COLMAP_SIZE];
+} editor_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-  void init_editor(uint8_t *_text, uint16_t _max, uint8_t _rows);
+  void init_editor(editor_t *_ed, uint8_t *_text, offset_t _max, offset_t *_lines, row_t _rows, col_t _columns);
+  void init_mapped(editor_t *_ed, const uint8_t *_text, offset_t size, offset_t *_lines, row_t _rows, col_t _columns);
+  void select_editor(editor_t *_ed);
+  void set_view(offset_t *_lines, row_t _rows, offset_t top);
+  void set_resize_func(uint8_t *(*)(offset_t *));
+  void set_change_func(void (*)(offset_t));
   void import_start();
   int import_data(const uint8_t *src, int size);
   void import_end();
+  int append_data(const uint8_t *src, int size);
+  void mark_saved();
+  void fit_buffer();
+  int reserve_text(offset_t added);
+  void cut_head(offset_t end);
+  void cut_tail(offset_t start);
+  int insert_head(const uint8_t *src, offset_t size);
+  int append_tail(const uint8_t *src, offset_t size);
 
   void append_normalchar(uint8_t ch);
+  void append_char(const uint8_t *src, uint8_t len);
   void append_newline();
   void delete_char();
   void backspace_char();
   void kill_line();
 
+  void set_mark();
+  void exchange_mark();
+  int insert_text(const uint8_t *src, offset_t size);
+  void delete_text(offset_t start, offset_t end);
+  void duplicate_region();
+  void move_lines(int down);
+  void indent_lines(int dedent);
+  void comment_lines();
+  void filter_start(offset_t start, offset_t end);
+  const uint8_t *filter_next(offset_t *size);
+  int filter_put(const uint8_t *src, offset_t size);
+  void filter_end(int done);
+
   void move_left();
   void move_right();
   void move_up();
@@ -34,23 +136,34 @@ extern "C" {
   void move_end_of_line();
   void move_top_of_text();
   void move_end_of_text();
+  void move_to(offset_t offset);
+  row_t follow_end();
   void do_scroll_up();
   void do_scroll_down();
+  void adjust_view();
+  void adjust_leftcol();
 
-  const uint8_t *get_top_of_line(uint8_t y);
-  uint8_t get_charwidth(uint8_t ch, uint8_t pos);
+  const uint8_t *get_top_of_line(row_t y);
+  offset_t get_line_number(row_t y);
+  int get_region(offset_t *start, offset_t *end);
+  offset_t get_line_start(offset_t offset);
+  offset_t get_line_end(offset_t offset);
+  offset_t get_word_start(offset_t offset);
+  offset_t get_word_end(offset_t offset);
+  offset_t get_paragraph_start(offset_t offset);
+  offset_t get_paragraph_end(offset_t offset);
+  uint8_t get_charlen(const uint8_t *src);
+  uint8_t get_charwidth(const uint8_t *src, col_t pos);
 
   void print_status();
   void print_lines();
 
-  extern uint16_t lines[];
-  extern uint16_t numtext;
-  extern uint8_t curx, cury;
-  extern uint8_t modified;
-  extern enum DrawMode drawmode;
+  extern editor_t *ed;
+  extern uint8_t wrapmode;
   extern uint8_t tabwidth;
-  extern uint8_t rows;
 
 #ifdef __cplusplus
 };
 #endif
+
+#endif /* __EDITOR_H */
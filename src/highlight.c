@@ -0,0 +1,323 @@
+#include <string.h>
+#include "editor.h"
+#include "highlight.h"
+
+/* lexer states, LS_ESCAPE is set after a backslash in a string */
+enum {
+  LS_CODE = 0, LS_COMMENT, LS_STRING1, LS_STRING2, LS_LONG1, LS_LONG2
+};
+#define LS_MASK				0x07
+#define LS_ESCAPE			0x08
+
+static hl_cache_t *hl = NULL;
+
+static const uint8_t quotes[] = {
+  0, 0, '\'', '"', '\'', '"'
+};
+
+static const char * const keywords[] = {
+  "False", "None", "True", "and", "as", "assert", "async", "await",
+  "break", "class", "continue", "def", "del", "elif", "else", "except",
+  "finally", "for", "from", "global", "if", "import", "in", "is",
+  "lambda", "nonlocal", "not", "or", "pass", "raise", "return", "try",
+  "while", "with", "yield",
+};
+
+static void start(hl_lexer_t *lx, offset_t offset, uint8_t state);
+static uint8_t scan(offset_t from, uint8_t state, offset_t to);
+static uint8_t state_at(offset_t offset);
+static void add_mark(offset_t offset, uint8_t state);
+static int is_word(uint8_t ch);
+static int is_digit(uint8_t ch);
+static int is_keyword(const uint8_t *src, offset_t len);
+
+/*
+ * The cache holds the lexer state at the start of every visible row as
+ * it was when the rows were last drawn. A state is still good while no
+ * edit happened before its offset (hl->dirty). A few more states at
+ * former top rows are kept as marks so that scrolling back does not
+ * lex from the top of the text.
+ */
+
+/* rounded up so that the caches of split views can follow each other */
+size_t
+hl_cache_size(row_t _rows)
+{
+  size_t size = _rows * (sizeof(offset_t) + sizeof(uint8_t));
+  return (size + sizeof(offset_t) - 1) & ~(sizeof(offset_t) - 1);
+}
+
+void
+hl_select(hl_cache_t *_hl)
+{
+  hl = _hl;
+}
+
+void
+hl_init(void *cache)
+{
+  hl->offset = (offset_t *) cache;
+  hl->dirty = NOLINE;
+  hl->base = LS_CODE;
+  for (int i = 0; i < HL_MARKS; i ++) {
+    hl->mark_offset[i] = NOLINE;
+  }
+  hl->mark_next = 0;
+  if (hl->offset == NULL) {
+    return;
+  }
+  hl->state = (uint8_t *) &hl->offset[ed->rows];
+  for (int i = 0; i < ed->rows; i ++) {
+    hl->offset[i] = NOLINE;
+    hl->state[i] = LS_CODE;
+  }
+}
+
+void
+hl_changed(offset_t offset)
+{
+  if (offset < hl->dirty) {
+    hl->dirty = offset;
+  }
+  for (int i = 0; i < HL_MARKS; i ++) {
+    if (hl->mark_offset[i] != NOLINE && hl->mark_offset[i] > offset) {
+      hl->mark_offset[i] = NOLINE;
+    }
+  }
+}
+
+/* the state at the start of the text, when more text was before it */
+void
+hl_set_base(uint8_t state)
+{
+  hl->base = state;
+  hl->dirty = 0;
+  for (int i = 0; i < HL_MARKS; i ++) {
+    hl->mark_offset[i] = NOLINE;
+  }
+  for (int i = 0; hl->offset != NULL && i < ed->rows; i ++) {
+    hl->offset[i] = NOLINE;
+  }
+}
+
+uint8_t
+hl_state(offset_t offset)
+{
+  return state_at(offset);
+}
+
+void
+hl_prepare()
+{
+  if (hl->offset == NULL) {
+    return;
+  }
+  /* rows keep their index unless they were scrolled or inserted */
+  uint8_t same = ed->drawmode < DM_BELOW;
+  uint8_t state = state_at(ed->lines[0]);
+  add_mark(ed->lines[0], state);
+  for (row_t y = 0; y < ed->rows; y ++) {
+    if (ed->lines[y] == NOLINE) {
+      hl->offset[y] = NOLINE;
+      continue;
+    }
+    if (y > 0 && (hl->offset[y] != ed->lines[y] || ed->lines[y] > hl->dirty)) {
+      state = scan(ed->lines[y - 1], state, ed->lines[y]);
+      if (same && hl->offset[y] != NOLINE && state == hl->state[y]) {
+        /* converged: the rows below have only moved */
+        for (; y < ed->rows; y ++) {
+          hl->offset[y] = ed->lines[y];
+        }
+        break;
+      }
+      if (state != hl->state[y] && ed->drawmode < DM_BELOW) {
+        ed->drawmode = DM_BELOW;
+      }
+    } else if (y > 0) {
+      state = hl->state[y];
+    }
+    hl->offset[y] = ed->lines[y];
+    hl->state[y] = state;
+  }
+  hl->dirty = NOLINE;
+}
+
+void
+hl_begin(hl_lexer_t *lx, row_t y)
+{
+  start(lx, ed->lines[y], hl->offset != NULL ? hl->state[y] : LS_CODE);
+}
+
+uint8_t
+hl_next(hl_lexer_t *lx, const uint8_t *src)
+{
+  uint8_t ch = *src;
+  uint8_t word = lx->word;
+  lx->word = is_word(ch);
+  if (lx->run) {
+    lx->run --;
+    return lx->token;
+  }
+  uint8_t state = lx->state & LS_MASK;
+  if (lx->state & LS_ESCAPE) {
+    lx->state = state;
+    return HL_STRING;
+  }
+  switch (state) {
+  case LS_CODE:
+    if (ch == '#') {
+      lx->state = LS_COMMENT;
+      return HL_COMMENT;
+    }
+    if (ch == '\'' || ch == '"') {
+      uint8_t q = (ch == '"');
+      if (src[1] == ch && src[2] == ch) {
+        lx->state = LS_LONG1 + q;
+        lx->run = 2;
+        lx->token = HL_STRING;
+      } else {
+        lx->state = LS_STRING1 + q;
+      }
+      return HL_STRING;
+    }
+    if (!word && lx->word && !is_digit(ch)) {
+      offset_t len = 1;
+      while (is_word(src[len])) {
+        len ++;
+      }
+      if (is_keyword(src, len)) {
+        lx->run = len - 1;
+        lx->token = HL_KEYWORD;
+        return HL_KEYWORD;
+      }
+    }
+    return HL_NORMAL;
+  case LS_COMMENT:
+    if (ch == LF) {
+      lx->state = LS_CODE;
+      return HL_NORMAL;
+    }
+    return HL_COMMENT;
+  case LS_STRING1:
+  case LS_STRING2:
+    if (ch == '\\') {
+      lx->state |= LS_ESCAPE;
+    } else if (ch == LF) {
+      lx->state = LS_CODE;
+      return HL_NORMAL;
+    } else if (ch == quotes[state]) {
+      lx->state = LS_CODE;
+    }
+    return HL_STRING;
+  default:
+    if (ch == '\\') {
+      lx->state |= LS_ESCAPE;
+    } else if (ch == quotes[state] && src[1] == ch && src[2] == ch) {
+      lx->state = LS_CODE;
+      lx->run = 2;
+      lx->token = HL_STRING;
+    }
+    return HL_STRING;
+  }
+}
+
+/* support functions */
+
+static void
+start(hl_lexer_t *lx, offset_t offset, uint8_t state)
+{
+  lx->state = state;
+  lx->run = 0;
+  lx->token = HL_NORMAL;
+  lx->word = (offset > 0) && is_word(ed->text[offset - 1]);
+  if (!lx->word || state != LS_CODE) {
+    return;
+  }
+  /* a wrapped row starting inside a word */
+  offset_t top = offset - 1;
+  while (top > 0 && is_word(ed->text[top - 1])) {
+    top --;
+  }
+  offset_t end = offset;
+  while (is_word(ed->text[end])) {
+    end ++;
+  }
+  if (!is_digit(ed->text[top]) && is_keyword(&ed->text[top], end - top)) {
+    lx->run = end - offset;
+    lx->token = HL_KEYWORD;
+  }
+}
+
+static uint8_t
+scan(offset_t from, uint8_t state, offset_t to)
+{
+  hl_lexer_t lx;
+  start(&lx, from, state);
+  const uint8_t *src = &ed->text[from];
+  while (from ++ < to) {
+    hl_next(&lx, src++);
+  }
+  return lx.state;
+}
+
+static uint8_t
+state_at(offset_t offset)
+{
+  offset_t base = 0;
+  uint8_t state = hl->base;
+  for (int i = 0; i < HL_MARKS; i ++) {
+    if (hl->mark_offset[i] != NOLINE && hl->mark_offset[i] <= offset && hl->mark_offset[i] >= base) {
+      base = hl->mark_offset[i];
+      state = hl->mark_state[i];
+    }
+  }
+  for (int i = 0; hl->offset != NULL && i < ed->rows; i ++) {
+    offset_t o = hl->offset[i];
+    if (o != NOLINE && o <= hl->dirty && o <= offset && o >= base) {
+      base = o;
+      state = hl->state[i];
+    }
+  }
+  return scan(base, state, offset);
+}
+
+static void
+add_mark(offset_t offset, uint8_t state)
+{
+  for (int i = 0; i < HL_MARKS; i ++) {
+    if (hl->mark_offset[i] == offset) {
+      hl->mark_state[i] = state;
+      return;
+    }
+  }
+  hl->mark_offset[hl->mark_next] = offset;
+  hl->mark_state[hl->mark_next] = state;
+  hl->mark_next = (hl->mark_next + 1) % HL_MARKS;
+}
+
+static int
+is_word(uint8_t ch)
+{
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+    || is_digit(ch) || ch == '_' || ch >= 0x80;
+}
+
+static int
+is_digit(uint8_t ch)
+{
+  return ch >= '0' && ch <= '9';
+}
+
+static int
+is_keyword(const uint8_t *src, offset_t len)
+{
+  if (len < 2 || len > 8) {
+    return 0;
+  }
+  for (size_t i = 0; i < sizeof keywords / sizeof keywords[0]; i ++) {
+    if (strlen(keywords[i]) == len && memcmp(keywords[i], src, len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
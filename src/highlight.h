@@ -0,0 +1,50 @@
+#ifndef __HIGHLIGHT_H
+#define __HIGHLIGHT_H
+
+#include <stddef.h>
+#include "editor.h"
+
+#define HL_MARKS			8
+
+/* token classes */
+enum {
+  HL_NORMAL = 0, HL_KEYWORD, HL_STRING, HL_COMMENT
+};
+
+typedef struct {
+  uint8_t state;
+  uint8_t run;
+  uint8_t token;
+  uint8_t word;
+} hl_lexer_t;
+
+/* the cache of one editor context */
+typedef struct {
+  offset_t *offset;
+  uint8_t *state;
+  offset_t dirty;
+  uint8_t base;
+  offset_t mark_offset[HL_MARKS];
+  uint8_t mark_state[HL_MARKS];
+  uint8_t mark_next;
+} hl_cache_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  size_t hl_cache_size(row_t _rows);
+  void hl_select(hl_cache_t *_hl);
+  void hl_init(void *cache);
+  void hl_changed(offset_t offset);
+  void hl_set_base(uint8_t state);
+  uint8_t hl_state(offset_t offset);
+  void hl_prepare();
+  void hl_begin(hl_lexer_t *lx, row_t y);
+  uint8_t hl_next(hl_lexer_t *lx, const uint8_t *src);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __HIGHLIGHT_H */
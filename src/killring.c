@@ -0,0 +1,121 @@
+#include <string.h>
+#include "editor.h"
+#include "killring.h"
+
+/*
+ * The kill ring keeps the killed texts in KILL_RING_SIZE bytes, oldest
+ * first. Each entry is its length followed by the bytes. When a new
+ * entry does not fit, or there are MAX_ENTRIES of them, the oldest ones
+ * are dropped with a single move of the rest.
+ */
+
+#define HEADER_SIZE		sizeof(offset_t)
+#define MAX_ENTRIES		16
+
+static uint8_t *ring = NULL;
+static size_t used;
+static uint8_t count;
+static size_t last;
+
+static offset_t get_length(size_t pos);
+static void set_length(size_t pos, offset_t size);
+static int make_room(size_t size, int entry);
+
+void
+kr_init(uint8_t *_ring)
+{
+  ring = _ring;
+  used = 0;
+  count = 0;
+  last = 0;
+}
+
+/* append extends the newest entry, as consecutive kills do */
+int
+kr_add(const uint8_t *src, offset_t size, int append)
+{
+  if (ring == NULL) {
+    return 0;
+  }
+  if (append && count > 0) {
+    offset_t length = get_length(last);
+    if (HEADER_SIZE + length + size > KILL_RING_SIZE
+        || !make_room(size, 0)) {
+      return 0;
+    }
+    memcpy(&ring[used], src, size);
+    used += size;
+    set_length(last, length + size);
+    return 1;
+  }
+  if (HEADER_SIZE + size > KILL_RING_SIZE || !make_room(HEADER_SIZE + size, 1)) {
+    return 0;
+  }
+  last = used;
+  set_length(last, size);
+  memcpy(&ring[last + HEADER_SIZE], src, size);
+  used += HEADER_SIZE + size;
+  count ++;
+  return 1;
+}
+
+/* index 0 is the newest entry */
+const uint8_t *
+kr_get(uint8_t index, offset_t *size)
+{
+  if (ring == NULL || index >= count) {
+    return NULL;
+  }
+  size_t pos = 0;
+  for (uint8_t i = count - 1; i > index; i --) {
+    pos += HEADER_SIZE + get_length(pos);
+  }
+  *size = get_length(pos);
+  return &ring[pos + HEADER_SIZE];
+}
+
+uint8_t
+kr_count()
+{
+  return count;
+}
+
+/* support functions */
+
+static offset_t
+get_length(size_t pos)
+{
+  offset_t size;
+  memcpy(&size, &ring[pos], HEADER_SIZE);
+  return size;
+}
+
+static void
+set_length(size_t pos, offset_t size)
+{
+  memcpy(&ring[pos], &size, HEADER_SIZE);
+}
+
+/* drop the oldest entries until size more bytes, or an entry, fit */
+static int
+make_room(size_t size, int entry)
+{
+  size_t drop = 0;
+  uint8_t dropped = 0;
+  while (used - drop + size > KILL_RING_SIZE
+         || (entry && count - dropped >= MAX_ENTRIES)) {
+    if (drop >= (entry ? used : last)) {
+      return 0;
+    }
+    drop += HEADER_SIZE + get_length(drop);
+    dropped ++;
+  }
+  if (drop == 0) {
+    return 1;
+  }
+  memmove(ring, &ring[drop], used - drop);
+  used -= drop;
+  last -= drop;
+  count -= dropped;
+  return 1;
+}
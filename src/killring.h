@@ -0,0 +1,26 @@
+#ifndef __KILLRING_H
+#define __KILLRING_H
+
+#include <stddef.h>
+#include "editor.h"
+
+#ifndef MODEDITOR_KILL_RING_SIZE
+#define MODEDITOR_KILL_RING_SIZE	1024
+#endif
+
+#define KILL_RING_SIZE		MODEDITOR_KILL_RING_SIZE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void kr_init(uint8_t *ring);
+  int kr_add(const uint8_t *src, offset_t size, int append);
+  const uint8_t *kr_get(uint8_t index, offset_t *size);
+  uint8_t kr_count();
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __KILLRING_H */
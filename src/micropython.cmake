@@ -6,6 +6,10 @@ target_sources(usermod_editor INTERFACE
     ${CMAKE_CURRENT_LIST_DIR}/modeditor.c
     ${CMAKE_CURRENT_LIST_DIR}/editor.c
     ${CMAKE_CURRENT_LIST_DIR}/ucurses.c
+    ${CMAKE_CURRENT_LIST_DIR}/highlight.c
+    ${CMAKE_CURRENT_LIST_DIR}/killring.c
+    ${CMAKE_CURRENT_LIST_DIR}/outring.c
+    ${CMAKE_CURRENT_LIST_DIR}/cold.c
 )
 
 # Add the current directory as an include directory.
@@ -15,3 +19,26 @@ target_include_directories(usermod_editor INTERFACE
 
 # Link our INTERFACE library to the usermod target.
 target_link_libraries(usermod INTERFACE usermod_editor)
+
+# Build-time options:
+#   MODEDITOR_STATIC_BUFFER_SIZE  reserve the buffer in a static section (bytes)
+#   MODEDITOR_OFFSET_BITS         16 (default, up to 64KiB) or 32
+#   MODEDITOR_COLUMN_BITS         16 (default) or 8 (up to 255 columns)
+#   MODEDITOR_MAX_ROWS            maximum screen rows (default 255)
+#   MODEDITOR_KILL_RING_SIZE      bytes kept for cut and copied text (default 1024)
+#   MODEDITOR_OUTPUT_RING_SIZE    write the screen from another thread (power of 2, default 0 = off)
+#   MODEDITOR_FRAME_BUFFER_SIZE   bytes of screen output sent at once (default 256)
+# e.g. -DMODEDITOR_OFFSET_BITS=32
+foreach(opt
+    MODEDITOR_STATIC_BUFFER_SIZE
+    MODEDITOR_OFFSET_BITS
+    MODEDITOR_COLUMN_BITS
+    MODEDITOR_MAX_ROWS
+    MODEDITOR_KILL_RING_SIZE
+    MODEDITOR_OUTPUT_RING_SIZE
+    MODEDITOR_FRAME_BUFFER_SIZE
+)
+    if(${opt})
+        target_compile_definitions(usermod_editor INTERFACE ${opt}=${${opt}})
+    endif()
+endforeach()
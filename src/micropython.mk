@@ -4,6 +4,22 @@ EDITOR_MOD_DIR := $(USERMOD_DIR)
 SRC_USERMOD += $(EDITOR_MOD_DIR)/modeditor.c
 SRC_USERMOD += $(EDITOR_MOD_DIR)/editor.c
 SRC_USERMOD += $(EDITOR_MOD_DIR)/ucurses.c
+SRC_USERMOD += $(EDITOR_MOD_DIR)/highlight.c
+SRC_USERMOD += $(EDITOR_MOD_DIR)/killring.c
+SRC_USERMOD += $(EDITOR_MOD_DIR)/outring.c
+SRC_USERMOD += $(EDITOR_MOD_DIR)/cold.c
 
 # We can add our module folder to include paths if needed
 CFLAGS_USERMOD += -I$(EDITOR_MOD_DIR)
+
+# Build-time options:
+#   MODEDITOR_STATIC_BUFFER_SIZE  reserve the buffer in a static section (bytes)
+#   MODEDITOR_OFFSET_BITS         16 (default, up to 64KiB) or 32
+#   MODEDITOR_COLUMN_BITS         16 (default) or 8 (up to 255 columns)
+#   MODEDITOR_MAX_ROWS            maximum screen rows (default 255)
+#   MODEDITOR_KILL_RING_SIZE      bytes kept for cut and copied text (default 1024)
+#   MODEDITOR_OUTPUT_RING_SIZE    write the screen from another thread (power of 2, default 0 = off)
+#   MODEDITOR_FRAME_BUFFER_SIZE   bytes of screen output sent at once (default 256)
+# e.g. make USER_C_MODULES=... MODEDITOR_OFFSET_BITS=32
+MODEDITOR_OPTIONS := MODEDITOR_STATIC_BUFFER_SIZE MODEDITOR_OFFSET_BITS MODEDITOR_COLUMN_BITS MODEDITOR_MAX_ROWS MODEDITOR_KILL_RING_SIZE MODEDITOR_OUTPUT_RING_SIZE MODEDITOR_FRAME_BUFFER_SIZE
+CFLAGS_USERMOD += $(foreach opt,$(MODEDITOR_OPTIONS),$(if $($(opt)),-D$(opt)=$($(opt))))
@@ -4,47 +4,194 @@
 #include "extmod/vfs.h"
 #include "editor.h"
 #include "ucurses.h"
+#include "highlight.h"
+#include "killring.h"
+#include "cold.h"
+#include "outring.h"
+#if OUTPUT_RING_SIZE > 0 && MICROPY_PY_THREAD
+#include "py/mpthread.h"
+#endif
+#include <stdio.h>
 #include <string.h>
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #define EDITOR_OFFSETX      0
 #define EDITOR_OFFSETY      0
+#define FOLLOW_BUFFER_SIZE  4096
+#define FOLLOW_INTERVAL     200
+#define SAVE_BLOCK_SIZE     512
+#define AUTOSAVE_CHUNK      256
+#define RECOVERY_SUFFIX     ".sav"
+#define RECOVERY_HEADER     4
+#define MACRO_SIZE          128
+#define MAX_BUFFERS         4
+#define MAX_WINDOWS         2
+#define COLD_SLACK          COLD_CHUNK
+#define FILTER_CHUNK        256
+
+/* a file kept in memory with its editor context */
+typedef struct {
+  editor_t ed;
+  hl_cache_t hl;
+  const char *filename;
+  col_t gutter;
+  offset_t top;
+  uint8_t autosave_valid, autosave_seek;
+  offset_t autosave_dirty, autosave_pos;
+  cold_t cold;
+  /* the file on flash when it was read or saved */
+  mp_int_t file_size, file_time;
+  uint8_t read_only;
+} buffer_t;
 
-static uint16_t buffer_size = 1024;
-static uint8_t *buffer = NULL;
-static uint8_t editor_columns = 40;
-static uint8_t editor_rows = 10;
+static buffer_t buffers[MAX_BUFFERS];
+static buffer_t *curbuf;
+static uint8_t buffer_count = 0;
+static struct {
+  buffer_t *buffer;
+  row_t top, rows;
+  uint8_t shown;
+} windows[MAX_WINDOWS];
+static uint8_t window_count = 1, window = 0;
+static uint8_t redraw_windows = 0;
+static row_t screen_top = 0;
+
+static size_t buffer_size = 0;
+static uint8_t buffer_fixed;
+#ifdef MODEDITOR_STATIC_BUFFER_SIZE
+static uint8_t static_buffer[MODEDITOR_STATIC_BUFFER_SIZE];
+#endif /* MODEDITOR_STATIC_BUFFER_SIZE */
+static col_t editor_columns = 40;
+static row_t editor_rows = 10;
+static uint8_t auto_screen = 0;
+static uint8_t highlight = 0;
+static uint8_t line_numbers = 0;
+static uint8_t status_line = 0;
+static uint8_t compress = 0;
+static uint8_t read_only = 0;
+static char status_shown[64];
+static uint16_t autosave_time = 0;
+static buffer_t *saving = NULL;
+static uint16_t macro[MACRO_SIZE];
+static uint8_t macro_length = 0, macro_pos;
+static uint8_t key_start;
+static int pushed_key = -1;
+static uint8_t recording = 0, macro_failed;
+static uint16_t replaying = 0;
+static enum DrawMode pending;
+static row_t pending_row;
+
+static void select_buffer(buffer_t *buffer);
+static void note_file(buffer_t *buffer);
+static int file_changed(buffer_t *buffer);
+static void reload_file(const char *filename);
+static void autosave_idle();
+static int thaw(uint8_t tail);
+static void cold_balance();
+static int fits_fixed_buffer(mp_obj_t buffer_obj, uint8_t compressed);
+static size_t table_size = 0;
+
+static const int hl_attrs[] = {
+  A_NORMAL, FG(COLOR_MAGENTA), FG(COLOR_GREEN), FG(COLOR_CYAN)
+};
 
 STATIC mp_obj_t
-set_screen(mp_obj_t width_obj, mp_obj_t height_obj)
+set_screen(size_t n_args, const mp_obj_t *args)
 {
-  int size = mp_obj_get_int(width_obj);
-  if (size > 0 && size < 256) {
+  if (n_args == 0) {
+    auto_screen = 1;
+    return mp_const_none;
+  }
+  if (n_args == 1) {
+    mp_raise_TypeError(MP_ERROR_TEXT("both width and height are required."));
+  }
+  int size = mp_obj_get_int(args[0]);
+  if (size > 0 && size <= MAX_COLUMNS) {
     editor_columns = size;
   } else {
     mp_raise_ValueError(MP_ERROR_TEXT("Width values are exceeded."));
   }
-  size = mp_obj_get_int(height_obj);
+  size = mp_obj_get_int(args[1]);
   if (size > 0 && size <= MAX_ROWS) {
     editor_rows = size;
   } else {
     mp_raise_ValueError(MP_ERROR_TEXT("Height values are exceeded."));
   }
+  auto_screen = 0;
   return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_2(set_screen_obj, set_screen);
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(set_screen_obj, 0, 2, set_screen);
 
 STATIC mp_obj_t
-set_buffer_size(mp_obj_t size_obj)
+set_buffer(mp_obj_t buffer_obj)
 {
-  int size = mp_obj_get_int(size_obj);
-  if (size > 0 && size < 65535) {
-    buffer_size = size;
+  if (!fits_fixed_buffer(buffer_obj, compress)) {
+    mp_raise_ValueError(MP_ERROR_TEXT("buffer is too small."));
+  }
+  MP_STATE_VM(editor_buffer_obj) = buffer_obj;
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_buffer_obj, set_buffer);
+
+STATIC mp_obj_t
+set_wrap(mp_obj_t flag_obj)
+{
+  wrapmode = mp_obj_is_true(flag_obj);
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_wrap_obj, set_wrap);
+
+STATIC mp_obj_t
+set_highlight(mp_obj_t flag_obj)
+{
+  highlight = mp_obj_is_true(flag_obj);
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_highlight_obj, set_highlight);
+
+STATIC mp_obj_t
+set_line_numbers(mp_obj_t flag_obj)
+{
+  line_numbers = mp_obj_is_true(flag_obj);
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_line_numbers_obj, set_line_numbers);
+
+STATIC mp_obj_t
+set_status(mp_obj_t flag_obj)
+{
+  status_line = mp_obj_is_true(flag_obj);
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_status_obj, set_status);
+
+STATIC mp_obj_t
+set_compress(mp_obj_t flag_obj)
+{
+  uint8_t flag = mp_obj_is_true(flag_obj);
+  if (flag && !fits_fixed_buffer(MP_STATE_VM(editor_buffer_obj), flag)) {
+    mp_raise_ValueError(MP_ERROR_TEXT("buffer is too small."));
+  }
+  compress = flag;
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_compress_obj, set_compress);
+
+STATIC mp_obj_t
+set_autosave(mp_obj_t seconds_obj)
+{
+  int seconds = mp_obj_get_int(seconds_obj);
+  if (seconds >= 0 && seconds <= 3600) {
+    autosave_time = seconds;
   } else {
-    mp_raise_ValueError(MP_ERROR_TEXT("size must be between 1 and 65534."));
+    mp_raise_ValueError(MP_ERROR_TEXT("autosave must be between 0 and 3600 seconds."));
   }
   return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_buffer_size_obj, set_buffer_size);
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(set_autosave_obj, set_autosave);
 
 STATIC mp_obj_t
 set_tab_width(mp_obj_t size_obj)
@@ -72,6 +219,108 @@ get_string(mp_obj_t obj, size_t *len)
   return str;
 }
 
+/* what ucurses keeps is sent before waiting */
+static int
+wait_key(int timeout)
+{
+  refresh();
+#ifdef __linux__
+  struct pollfd fds = { STDIN_FILENO, POLLIN, 0 };
+  return poll(&fds, 1, timeout) > 0;
+#else
+  mp_uint_t start = mp_hal_ticks_ms();
+  while (!(mp_hal_stdio_poll(MP_STREAM_POLL_RD) & MP_STREAM_POLL_RD)) {
+    if (mp_hal_ticks_ms() - start >= (mp_uint_t) timeout) {
+      return 0;
+    }
+    mp_hal_delay_ms(1);
+  }
+  return 1;
+#endif
+}
+
+#if OUTPUT_RING_SIZE > 0 && MICROPY_PY_THREAD
+/*
+ * The screen is written out by another thread (the second core on rp2)
+ * from the output ring, so the editor does not wait for the UART.
+ */
+#define OUTPUT_STACK_SIZE	2048
+#define OUTPUT_IDLE_US		100
+
+enum {
+  OT_STOPPED = 0, OT_RUNNING, OT_STOPPING
+};
+static volatile uint8_t output_state = OT_STOPPED;
+
+static void *
+output_entry(void *arg)
+{
+  mp_state_thread_t ts;
+  mp_thread_init_state(&ts, OUTPUT_STACK_SIZE, NULL, NULL);
+  mp_thread_start();
+  while (1) {
+	const char *str;
+	size_t count = or_peek(&str);
+	if (count > 0) {
+	  mp_hal_stdout_tx_strn(str, count);
+	  or_consume(count);
+	} else if (output_state == OT_STOPPING) {
+	  break;
+	} else {
+	  mp_hal_delay_us(OUTPUT_IDLE_US);
+	}
+  }
+  mp_thread_finish();
+  output_state = OT_STOPPED;
+  return NULL;
+}
+
+static void
+start_output()
+{
+  if (output_state == OT_STOPPED) {
+	size_t stack_size = OUTPUT_STACK_SIZE;
+	nlr_buf_t nlr;
+	or_reset();
+	output_state = OT_RUNNING;
+	if (nlr_push(&nlr) == 0) {
+	  mp_thread_create(output_entry, NULL, &stack_size);
+	  nlr_pop();
+	} else {
+	  /* no thread left: write directly */
+	  output_state = OT_STOPPED;
+	  return;
+	}
+  }
+  set_putnstr_func(or_write);
+}
+
+/* what ucurses keeps goes to the ring, which is then written out */
+static void
+stop_output()
+{
+  refresh();
+  if (output_state != OT_STOPPED) {
+	output_state = OT_STOPPING;
+	while (output_state != OT_STOPPED) {
+	  mp_hal_delay_us(OUTPUT_IDLE_US);
+	}
+  }
+  set_putnstr_func((void (*)(const char *, size_t))mp_hal_stdout_tx_strn);
+}
+#else /* OUTPUT_RING_SIZE > 0 && MICROPY_PY_THREAD */
+static void
+start_output()
+{
+}
+
+static void
+stop_output()
+{
+  refresh();
+}
+#endif /* OUTPUT_RING_SIZE > 0 && MICROPY_PY_THREAD */
+
 static void
 init_term()
 {
@@ -80,22 +329,46 @@ init_term()
 #endif
   set_putnstr_func((void (*)(const char *, size_t))mp_hal_stdout_tx_strn);
   set_getchar_func((int (*)(void))mp_hal_stdin_rx_chr);
+  set_kbhit_func(wait_key);
+  start_output();
 }
 
 static void
 deinit_term()
 {
+  stop_output();
 #ifdef __linux__
   mp_hal_stdio_mode_orig();
 #endif
 }
 
+static void
+detect_screen()
+{
+  int y, x;
+  init_term();
+  if (get_screen_size(&y, &x) && y > 1) {
+    editor_columns = x > MAX_COLUMNS ? MAX_COLUMNS : x;
+    y -= 1;
+    editor_rows = y > MAX_ROWS ? MAX_ROWS : y;
+  }
+  deinit_term();
+}
+
 static void show_status()
 {
   move(editor_rows+2, 0);
   clrtobot();
+  /* they print to stdout, after what is still in the ring */
+  stop_output();
   print_status();
   print_lines();
+  start_output();
+  uint32_t bytes, keys;
+  get_output_stats(&bytes, &keys);
+  char buf[48];
+  snprintf(buf, sizeof buf, "output=%lu bytes, keys=%lu", (unsigned long) bytes, (unsigned long) keys);
+  addstr(buf);
 }
 
 static int showing_message = 0;
@@ -103,7 +376,16 @@ static int showing_message = 0;
 static void
 show_message(const char *str)
 {
+  if (replaying) {
+    /* only errors are shown while replaying, and they stop it */
+    if (str == NULL || *str != '*') {
+      return;
+    }
+    macro_failed = 1;
+  }
   move(editor_rows, 0);
+  attrset(A_NORMAL);
+  status_shown[0] = NUL;
   if (str && *str) {
     addstr(str);
     showing_message = 1;
@@ -121,233 +403,2592 @@ clear_message()
   }
 }
 
+/* the size of the file, the compressed lines included */
+static uint32_t
+text_length()
+{
+  return curbuf->cold.head_raw + ed->numtext + curbuf->cold.tail_raw;
+}
+
+static void
+draw_status()
+{
+  char buf[sizeof status_shown];
+  if (!status_line || showing_message) {
+    return;
+  }
+  snprintf(buf, sizeof buf, "-%s- L%lu C%u  %lu bytes  %s",
+           curbuf->read_only ? "%%" : ed->modified ? "**" : "--", (unsigned long) (get_line_number(ed->cury) + curbuf->cold.head_lines),
+           (unsigned) ed->curx + 1, (unsigned long) text_length(), curbuf->filename);
+  if (strlen(buf) > editor_columns) {
+    buf[editor_columns] = NUL;
+  }
+  if (strcmp(buf, status_shown) == 0) {
+    return;
+  }
+  strcpy(status_shown, buf);
+  move(editor_rows, 0);
+  attrset(A_REVERSE);
+  addstr(buf);
+  attrset(A_NORMAL);
+  clrtoeol();
+}
+
+static void
+setup_gutter(uint32_t count)
+{
+  curbuf->gutter = 0;
+  if (line_numbers) {
+    col_t digits = 3;
+    for (count /= 1000; count > 0; count /= 10) {
+      digits ++;
+    }
+    if (digits + 1 + 8 <= editor_columns) {
+      curbuf->gutter = digits + 1;
+    }
+  }
+  ed->columns = editor_columns - curbuf->gutter;
+}
+
 void
-drawspaces(uint8_t count)
+drawspaces(col_t count)
 {
   while (count --) {
     addch(' ');
   }
 }
 
+static void
+drawgutter(row_t line)
+{
+  const uint8_t *src = get_top_of_line(line);
+  attrset(A_NORMAL);
+  if (src == NULL || (src > ed->text && src[-1] != LF)) {
+    drawspaces(curbuf->gutter);
+    return;
+  }
+  /* keeps the lower digits if the number outgrew the gutter */
+  char buf[16];
+  uint32_t number = get_line_number(line) + curbuf->cold.head_lines;
+  col_t i = curbuf->gutter;
+  buf[i] = NUL;
+  buf[-- i] = ' ';
+  while (i > 0) {
+    buf[-- i] = number ? '0' + number % 10 : ' ';
+    number /= 10;
+  }
+  addstr(buf);
+}
+
 void
-drawline(uint8_t line)
+drawline(row_t line)
 {
-  move(line + EDITOR_OFFSETY, EDITOR_OFFSETX);
+  move(screen_top + line + EDITOR_OFFSETY, EDITOR_OFFSETX);
+  if (curbuf->gutter) {
+    drawgutter(line);
+  }
   const uint8_t *src = get_top_of_line(line);
+  uint32_t right = (uint32_t) ed->leftcol + ed->columns;
+  uint32_t pos = 0;
   if (src != NULL) {
-    uint8_t pos = 0;
-    while (pos < editor_columns) {
-      uint8_t ch = *src++;
-      uint8_t step = 1;
+    hl_lexer_t lx;
+    if (highlight) {
+      hl_begin(&lx, line);
+    }
+    while (pos < right) {
+      uint8_t ch = *src;
       if (ch == NUL || ch == LF) {
         break;
-      } else if (ch == TAB) {
-        step = get_charwidth(ch, pos);
-        drawspaces(step);
-      } else if (ch >= ' ') {
+      }
+      uint8_t len = get_charlen(src);
+      col_t step = get_charwidth(src, pos);
+      if (wrapmode && pos > 0 && pos + step >= ed->columns) {
+        clrtoeol();
+        move(screen_top + line + EDITOR_OFFSETY, EDITOR_OFFSETX + editor_columns - 1);
+        attrset(A_NORMAL);
+        addch('\\');
+        return;
+      }
+      if (highlight) {
+        /* blanks show the same in any colour */
+        int attr = hl_attrs[hl_next(&lx, src)];
+        for (uint8_t i = 1; i < len; i ++) {
+          hl_next(&lx, src + i);
+        }
+        if (ch != ' ' && ch != TAB && pos >= ed->leftcol) {
+          attrset(attr);
+        }
+      }
+      if (ch == TAB || (step > 1 && (pos < ed->leftcol || pos + step > right))) {
+        /* a wide character cut by an edge shows as blanks */
+        if (pos + step > ed->leftcol) {
+          uint32_t start = pos < ed->leftcol ? ed->leftcol : pos;
+          uint32_t end = pos + step < right ? pos + step : right;
+          drawspaces(end - start);
+        }
+      } else if (ch >= 0x80 && pos >= ed->leftcol) {
+        if (len == 1) {
+          addch('?');
+        }
+        for (uint8_t i = 0; len > 1 && i < len; i ++) {
+          addch(src[i]);
+        }
+      } else if (ch >= ' ' && pos >= ed->leftcol) {
         addch(ch);
       }
+      src += len;
       pos += step;
     }
   }
-  clrtoeol();
+  /* a full row is not cleared: that would take the last column with it */
+  if (pos < right) {
+    clrtoeol();
+  }
 }
 
 void
 drawall()
 {
-  for (int i = 0; i < editor_rows; i ++) {
+  for (int i = 0; i < ed->rows; i ++) {
     drawline(i);
   }
 }
 
-void
-draw()
+static void
+draw_rows(row_t from)
+{
+  begin_update();
+  adjust_view();
+  hl_prepare();
+  if (ed->drawmode == DM_FULL) {
+    status_shown[0] = NUL;
+    from = 0;
+  }
+  for (row_t y = from; y < ed->rows; y ++) {
+    drawline(y);
+  }
+  ed->drawmode = DM_NONE;
+  draw_status();
+  end_update(ed->cury, curbuf->gutter + ed->curx - ed->leftcol);
+}
+
+static void
+draw_window()
 {
-  if (drawmode == DM_FULL) {
+  adjust_view();
+  hl_prepare();
+  if (ed->drawmode == DM_FULL) {
+    status_shown[0] = NUL;
     drawall();
-  } if (drawmode == DM_BELOW) {
+  } if (ed->drawmode == DM_BELOW) {
     drawall();
-  } else if (drawmode == DM_LINE) {
-    drawline(cury);
+  } else if (ed->drawmode == DM_LINE) {
+    drawline(ed->cury);
   }
-  drawmode = DM_NONE;
-  move(cury, min(curx,editor_columns-1));
+  ed->drawmode = DM_NONE;
 }
 
-#define CONTROL(key)    ((key)-'@')
-
-#ifndef __linux__
-extern int mp_interrupt_char;
-#endif
-
-int
-editor_main()
+/* the row under a split window shows the file in it */
+static void
+draw_mode_line(int i)
 {
-  int to_be_saved = 0;
-#ifndef __linux__
-  int interrupt_char = mp_interrupt_char;
-#endif
+  uint8_t shown = ed->modified + 1;
+  if (window_count == 1 || windows[i].shown == shown) {
+    return;
+  }
+  windows[i].shown = shown;
+  char buf[sizeof status_shown];
+  snprintf(buf, sizeof buf, "-%s- %s", curbuf->read_only ? "%%" : ed->modified ? "**" : "--", curbuf->filename);
+  size_t len = strlen(buf);
+  if (len > editor_columns) {
+    len = editor_columns;
+    buf[len] = NUL;
+  }
+  move(windows[i].top + windows[i].rows, 0);
+  attrset(A_REVERSE);
+  addstr(buf);
+  drawspaces(editor_columns - len);
+  attrset(A_NORMAL);
+}
 
-  while (1) {
-    draw();
-    int ch = getch();
-    clear_message();
-    if (ch == ESC) {
-      break;
-    } else if (ch == CONTROL('X')) {
-      show_message("C-x- ");
-      ch = getch();
-      if (ch == CONTROL('C')) {
-        break;
-      } else if (ch == CONTROL('S')) {
-        to_be_saved = 1;
-        break;
-      } else {
-        show_message("");
-      }
-    } else if (ch == KEY_LEFT || ch == CONTROL('B')) {
-      move_left();
-    } else if (ch == KEY_RIGHT || ch == CONTROL('F')) {
-      move_right();
-    } else if (ch == KEY_UP || ch == CONTROL('P')) {
-      move_up();
-    } else if (ch == KEY_DOWN || ch == CONTROL('N')) {
-      move_down();
-    } else if (ch == KEY_HOME || ch == CONTROL('A')) {
-      move_top_of_line();
-    } else if (ch == KEY_END || ch == CONTROL('E')) {
-      move_end_of_line();
-    } else if (ch == KEY_SHOME) {
-      move_top_of_text();
-    } else if (ch == KEY_SEND) {
-      move_end_of_text();
-    } else if (ch == KEY_PPAGE) {
-      do_scroll_up();
-    } else if (ch == KEY_NPAGE || ch == CONTROL('V')) {
-      do_scroll_down();
-    } else if (ch == CONTROL('J') || ch == CONTROL('M')) {
-      append_newline();
-    } else if (ch == CONTROL('I')) {
-      append_normalchar(ch);
-    } else if (ch == KEY_DC || ch == CONTROL('D')) {
-      delete_char();
-    } else if (ch == KEY_BACKSPACE || ch == CONTROL('H')) {
-      backspace_char();
-    } else if (ch == CONTROL('K')) {
-      kill_line();
-    } else if (ch == CONTROL('G')) {
-      drawmode = DM_FULL;
-    } else if (ch == CONTROL('Q')) {
-      show_status();
-    } else if (ch >= ' ' && ch < 0x80) {
-      append_normalchar(ch);
+/*
+ * Every window in one pass, as one frame of the terminal; then the
+ * cursor goes back to the current one.
+ */
+void
+draw()
+{
+  buffer_t *current = curbuf;
+  begin_update();
+  for (int i = 0; i < window_count; i ++) {
+    select_buffer(windows[i].buffer);
+    screen_top = windows[i].top;
+    if (redraw_windows) {
+      ed->drawmode = DM_FULL;
+      windows[i].shown = 0;
     }
+    draw_window();
+    draw_mode_line(i);
   }
-#ifndef __linux__
-  mp_interrupt_char = interrupt_char;
-#endif
-  return to_be_saved;
+  redraw_windows = 0;
+  select_buffer(current);
+  screen_top = windows[window].top;
+  draw_status();
+  end_update(screen_top + ed->cury, curbuf->gutter + ed->curx - ed->leftcol);
 }
 
+/*
+ * Buffers and windows: every buffer has its own editor context, so
+ * switching is only selecting another one. A window shows a buffer in
+ * its part of the shared line table; a hidden buffer keeps the offset
+ * of its top row to come back to.
+ */
+
 static void
-read_file(const char *filename)
+select_buffer(buffer_t *buffer)
 {
-  mp_obj_t args[2] = {
-    mp_obj_new_str(filename, strlen(filename)),
-    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
-  };
+  curbuf = buffer;
+  select_editor(&buffer->ed);
+  hl_select(&buffer->hl);
+  cold_select(&buffer->cold);
+}
 
-  mp_obj_t file;
-  nlr_buf_t nlr;
-  if (nlr_push(&nlr) == 0) {
-    file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
-    nlr_pop();
-  } else {
-    // new file
-    return;
+static void
+save_views()
+{
+  for (int i = 0; i < window_count; i ++) {
+    windows[i].buffer->top = windows[i].buffer->ed.lines[0];
   }
+}
 
-  int errcode;
-  byte buf[64];
-  uint16_t len;
-  do {
-	len = mp_stream_rw(file, buf, sizeof buf, &errcode, MP_STREAM_RW_READ | MP_STREAM_RW_ONCE);
-	if (errcode != 0) {
-	  mp_raise_OSError(errcode);
-	}
-	if (len) {
-	  if (!import_data((const uint8_t *) buf, len)) {
-		show_message("*** Insufficient buffer size! ***");
-		break;
-	  }
-	}
-  } while (len);
-  mp_stream_close(file);
-
-  import_end();
-  return;
+static void
+show_buffer(int i, buffer_t *buffer)
+{
+  uint8_t *table = MP_STATE_VM(editor_lines);
+  windows[i].buffer = buffer;
+  windows[i].shown = 0;
+  select_buffer(buffer);
+  set_view((offset_t *) table + windows[i].top, windows[i].rows, buffer->top);
+  table += editor_rows * sizeof(offset_t) + hl_cache_size(windows[i].top);
+  hl_init(highlight ? table : NULL);
+  hl_set_base(cold_head_state());
 }
 
+/* the rows are shared out with a mode line under each window */
 static void
-write_file(const char *filename, const uint8_t *buf, uint16_t size)
+layout_windows()
 {
-  mp_obj_t args[2] = {
-    mp_obj_new_str(filename, strlen(filename)),
-    MP_OBJ_NEW_QSTR(MP_QSTR_wb),
-  };
+  row_t top = 0;
+  row_t height = editor_rows;
+  if (window_count > 1) {
+    height -= window_count;
+  }
+  for (int i = 0; i < window_count; i ++) {
+    row_t count = (i < window_count - 1) ? height / window_count : height - top + i;
+    windows[i].top = top;
+    windows[i].rows = count;
+    show_buffer(i, windows[i].buffer);
+    top += count + (window_count > 1);
+  }
+  select_buffer(windows[window].buffer);
+  redraw_windows = 1;
+}
 
-  mp_obj_t file;
-  file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+/* the next buffer that is not in a window */
+static buffer_t *
+other_buffer()
+{
+  buffer_t *buffer = curbuf;
+  while (1) {
+    buffer = (buffer == &buffers[buffer_count - 1]) ? &buffers[0] : buffer + 1;
+    if (buffer == curbuf) {
+      return NULL;
+    }
+    int i;
+    for (i = 0; i < window_count && windows[i].buffer != buffer; i ++) {
+    }
+    if (i == window_count) {
+      return buffer;
+    }
+  }
+}
 
-  int errcode;
-  mp_stream_rw(file, (byte *) buf, size, &errcode, MP_STREAM_RW_WRITE | MP_STREAM_RW_ONCE);
-  if (errcode != 0) {
-    mp_raise_OSError(errcode);
+#define CONTROL(key)    ((key)-'@')
+
+/*
+ * Keyboard macro: the keys read while recording are kept in macro[].
+ * Replaying feeds them back without drawing; what each command leaves in
+ * drawmode is merged into pending and drawn once when the replay ends.
+ */
+
+static int
+read_key()
+{
+  if (replaying) {
+    return (macro_pos < macro_length) ? macro[macro_pos ++] : KEY_MAX;
+  }
+  int ch = pushed_key;
+  pushed_key = -1;
+  if (ch < 0) {
+    ch = getch();
   }
+  if (recording) {
+    if (macro_length < MACRO_SIZE) {
+      macro[macro_length ++] = ch;
+    } else {
+      recording = 0;
+      macro_length = 0;
+      show_message("*** Macro too long ***");
+    }
+  }
+  return ch;
+}
 
-  mp_stream_close(file);
+/* the key is read again as the next one, and recorded once */
+static void
+push_back_key(int key)
+{
+  if (replaying) {
+    if (key != KEY_MAX) {
+      macro_pos --;
+    }
+    return;
+  }
+  pushed_key = key;
+  if (recording && macro_length > 0) {
+    macro_length --;
+  }
 }
 
-STATIC mp_obj_t
-edit(mp_obj_t filename_obj)
+static void
+defer_draw()
 {
-  size_t filename_len = 0;
-  const char *filename = get_string(filename_obj, &filename_len);
-  if (filename_len == 0) {
-    mp_raise_ValueError(MP_ERROR_TEXT("filename must not be empty."));
+  if (ed->drawmode == DM_LINE && pending == DM_LINE && pending_row != ed->cury) {
+    pending = DM_BELOW;
+  } else if (ed->drawmode > pending) {
+    pending = ed->drawmode;
+    pending_row = ed->cury;
   }
-  buffer = (uint8_t *) m_malloc(buffer_size);
+  ed->drawmode = DM_NONE;
+}
 
-  init_term();
-  initscr();
-  clear();
-  move(0,0);
-  init_editor(buffer, buffer_size, editor_rows);
-  read_file(filename);
-  if (editor_main()) {
-	write_file(filename, buffer, strlen((const char*) buffer));
+static int
+next_key()
+{
+  if (replaying) {
+    adjust_view();
+    defer_draw();
+    if (macro_pos >= macro_length) {
+      macro_pos = 0;
+      replaying --;
+    }
+    if (replaying && !macro_failed) {
+      return read_key();
+    }
+    replaying = 0;
+    /* the changed line is not the one the cursor was left on */
+    if (pending == DM_LINE && pending_row != ed->cury) {
+      pending = DM_BELOW;
+    }
+    ed->drawmode = pending;
   }
-  move(editor_rows, 0);
-  endwin();
-  deinit_term();
+  draw();
+  autosave_idle();
+  return read_key();
+}
 
-#if MICROPY_MALLOC_USES_ALLOCATED_SIZE
-  m_free(buffer, buffer_size);
+static void
+start_macro()
+{
+  if (recording || replaying) {
+    return;
+  }
+  recording = 1;
+  macro_length = 0;
+  show_message("Defining macro...");
+}
+
+static void
+end_macro()
+{
+  if (!recording) {
+    return;
+  }
+  /* drop the keys of the command that ended it */
+  recording = 0;
+  macro_length = key_start;
+  show_message("Macro defined");
+}
+
+static void
+replay_macro(uint16_t count)
+{
+  if (recording) {
+    end_macro();
+    return;
+  }
+  if (replaying || macro_length == 0) {
+    return;
+  }
+  replaying = count;
+  macro_pos = 0;
+  macro_failed = 0;
+  pending = ed->drawmode;
+  pending_row = ed->cury;
+  ed->drawmode = DM_NONE;
+}
+
+/* C-u and digits, returns the count and the key after them in *ch */
+static uint16_t
+read_count(int *ch)
+{
+  char buf[16];
+  uint32_t count = 0;
+  show_message("C-u-");
+  while ((*ch = read_key()) >= '0' && *ch <= '9') {
+    count = count * 10 + (*ch - '0');
+    if (count > 0xFFFF) {
+      count = 0xFFFF;
+    }
+    snprintf(buf, sizeof buf, "C-u %u-", (unsigned) count);
+    show_message(buf);
+  }
+  show_message("");
+  return count ? count : 4;
+}
+
+static int
+kill_text(offset_t start, offset_t end, int append)
+{
+  if (start >= end) {
+    return 0;
+  }
+  if (!kr_add(&ed->text[start], end - start, append)) {
+    show_message("*** Too large for the kill ring ***");
+    return 0;
+  }
+  return 1;
+}
+
+static int
+yank(uint8_t index)
+{
+  offset_t size;
+  const uint8_t *src = kr_get(index, &size);
+  if (src == NULL) {
+    return 0;
+  }
+  ed->mark = ed->cursor;
+  if (!insert_text(src, size)) {
+    show_message("*** Insufficient buffer size! ***");
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Key bindings: keymap[] maps a key code to a command and cx_keymap[]
+ * the key after C-x. Both are const and stay in ROM; the keys rebound
+ * with editor.bind() are kept in overlay[] and looked up first. A key
+ * bound to a filter registered with editor.register_filter() runs the
+ * filter command with the index of that filter.
+ */
+
+enum {
+  CMD_IGNORE = 0, CMD_SELF_INSERT, CMD_FORWARD_CHAR, CMD_BACKWARD_CHAR,
+  CMD_PREVIOUS_LINE, CMD_NEXT_LINE, CMD_BEGINNING_OF_LINE, CMD_END_OF_LINE,
+  CMD_BEGINNING_OF_TEXT, CMD_END_OF_TEXT, CMD_PAGE_UP, CMD_PAGE_DOWN,
+  CMD_FORWARD_WORD, CMD_BACKWARD_WORD, CMD_FORWARD_PARAGRAPH,
+  CMD_BACKWARD_PARAGRAPH, CMD_NEWLINE, CMD_DELETE_CHAR, CMD_BACKSPACE,
+  CMD_KILL_LINE, CMD_KILL_WORD, CMD_BACKWARD_KILL_WORD,
+  CMD_SET_MARK, CMD_EXCHANGE_MARK, CMD_KILL_REGION, CMD_COPY_REGION,
+  CMD_YANK, CMD_YANK_POP, CMD_DUPLICATE, CMD_MOVE_LINES_UP,
+  CMD_MOVE_LINES_DOWN, CMD_INDENT, CMD_DEDENT, CMD_COMMENT, CMD_FILTER,
+  CMD_START_MACRO, CMD_END_MACRO, CMD_REPLAY_MACRO, CMD_REPEAT,
+  CMD_REDRAW, CMD_SHOW_STATUS, CMD_QUIT, CMD_SAVE_AND_QUIT, CMD_RELOAD,
+  CMD_NEXT_BUFFER, CMD_SPLIT_WINDOW, CMD_OTHER_WINDOW, CMD_ONE_WINDOW,
+  CMD_CX_PREFIX, CMD_COUNT
+};
+
+#define KEYMAP_SIZE         01000
+#define META_INDEX(c)       (0200 + (c))
+#define KEY_CX(c)           (02000 + (c))
+#define OVERLAY_SIZE        16
+#define NO_FILTER           0xFF
+
+static const uint8_t keymap[KEYMAP_SIZE] = {
+  [0] = CMD_SET_MARK,
+  [CONTROL('A')] = CMD_BEGINNING_OF_LINE,
+  [CONTROL('B')] = CMD_BACKWARD_CHAR,
+  [CONTROL('D')] = CMD_DELETE_CHAR,
+  [CONTROL('E')] = CMD_END_OF_LINE,
+  [CONTROL('F')] = CMD_FORWARD_CHAR,
+  [CONTROL('G')] = CMD_REDRAW,
+  [CONTROL('H')] = CMD_BACKSPACE,
+  [CONTROL('I')] = CMD_SELF_INSERT,
+  [CONTROL('J')] = CMD_NEWLINE,
+  [CONTROL('K')] = CMD_KILL_LINE,
+  [CONTROL('M')] = CMD_NEWLINE,
+  [CONTROL('N')] = CMD_NEXT_LINE,
+  [CONTROL('P')] = CMD_PREVIOUS_LINE,
+  [CONTROL('Q')] = CMD_SHOW_STATUS,
+  [CONTROL('U')] = CMD_REPEAT,
+  [CONTROL('V')] = CMD_PAGE_DOWN,
+  [CONTROL('W')] = CMD_KILL_REGION,
+  [CONTROL('X')] = CMD_CX_PREFIX,
+  [CONTROL('Y')] = CMD_YANK,
+  [ESC] = CMD_QUIT,
+  [META_INDEX(CONTROL('H'))] = CMD_BACKWARD_KILL_WORD,
+  [META_INDEX('#')] = CMD_COMMENT,
+  [META_INDEX('D')] = CMD_DUPLICATE,
+  [META_INDEX('b')] = CMD_BACKWARD_WORD,
+  [META_INDEX('d')] = CMD_KILL_WORD,
+  [META_INDEX('f')] = CMD_FORWARD_WORD,
+  [META_INDEX('i')] = CMD_INDENT,
+  [META_INDEX('n')] = CMD_MOVE_LINES_DOWN,
+  [META_INDEX('p')] = CMD_MOVE_LINES_UP,
+  [META_INDEX('u')] = CMD_DEDENT,
+  [META_INDEX('w')] = CMD_COPY_REGION,
+  [META_INDEX('y')] = CMD_YANK_POP,
+  [META_INDEX('{')] = CMD_BACKWARD_PARAGRAPH,
+  [META_INDEX('|')] = CMD_FILTER,
+  [META_INDEX('}')] = CMD_FORWARD_PARAGRAPH,
+  [META_INDEX(DEL)] = CMD_BACKWARD_KILL_WORD,
+  [KEY_DOWN] = CMD_NEXT_LINE,
+  [KEY_UP] = CMD_PREVIOUS_LINE,
+  [KEY_LEFT] = CMD_BACKWARD_CHAR,
+  [KEY_RIGHT] = CMD_FORWARD_CHAR,
+  [KEY_HOME] = CMD_BEGINNING_OF_LINE,
+  [KEY_BACKSPACE] = CMD_BACKSPACE,
+  [KEY_DC] = CMD_DELETE_CHAR,
+  [KEY_END] = CMD_END_OF_LINE,
+  [KEY_NPAGE] = CMD_PAGE_DOWN,
+  [KEY_PPAGE] = CMD_PAGE_UP,
+  [KEY_SEND] = CMD_END_OF_TEXT,
+  [KEY_SHOME] = CMD_BEGINNING_OF_TEXT,
+};
+
+static const uint8_t cx_keymap[0200] = {
+  [CONTROL('C')] = CMD_QUIT,
+  [CONTROL('R')] = CMD_RELOAD,
+  [CONTROL('S')] = CMD_SAVE_AND_QUIT,
+  [CONTROL('X')] = CMD_EXCHANGE_MARK,
+  ['('] = CMD_START_MACRO,
+  [')'] = CMD_END_MACRO,
+  ['1'] = CMD_ONE_WINDOW,
+  ['2'] = CMD_SPLIT_WINDOW,
+  ['E'] = CMD_REPLAY_MACRO,
+  ['b'] = CMD_NEXT_BUFFER,
+  ['e'] = CMD_REPLAY_MACRO,
+  ['o'] = CMD_OTHER_WINDOW,
+};
+
+/* the commands that change the text, which a read-only buffer ignores */
+static const uint8_t editing_commands[] = {
+  CMD_SELF_INSERT, CMD_NEWLINE, CMD_DELETE_CHAR, CMD_BACKSPACE,
+  CMD_KILL_LINE, CMD_KILL_WORD, CMD_BACKWARD_KILL_WORD, CMD_KILL_REGION,
+  CMD_YANK, CMD_YANK_POP, CMD_DUPLICATE, CMD_MOVE_LINES_UP,
+  CMD_MOVE_LINES_DOWN, CMD_INDENT, CMD_DEDENT, CMD_COMMENT, CMD_FILTER,
+  CMD_RELOAD,
+};
+
+static struct {
+  uint16_t key;
+  uint8_t command;
+  uint8_t filter;
+} overlay[OVERLAY_SIZE];
+static uint8_t overlay_count = 0;
+static uint8_t last_filter = 0;
+
+enum {
+  EXIT_NONE = 0, EXIT_QUIT, EXIT_SAVE
+};
+
+static uint8_t editor_exit;
+static int this_key;
+static uint8_t this_command, last_command;
+static uint16_t arg_count;
+static uint8_t yank_index;
+
+static void run_key(int key);
+
+static void
+cmd_ignore()
+{
+}
+
+static void
+cmd_self_insert()
+{
+  if (this_key >= ' ' && this_key < 0x80) {
+    append_normalchar(this_key);
+  } else if (this_key >= 0xC0 && this_key < 0xF8) {
+    /* the rest of the UTF-8 sequence follows at once */
+    uint8_t buf[4] = { this_key };
+    uint8_t len = (this_key >= 0xF0) ? 4 : (this_key >= 0xE0) ? 3 : 2;
+    for (uint8_t i = 1; i < len; i ++) {
+      int key = read_key();
+      if ((key & ~0x3F) != 0x80) {
+        /* a key that cuts the sequence short is run as it is */
+        push_back_key(key);
+        return;
+      }
+      buf[i] = key;
+    }
+    /* the sequence is read once, so this takes the count */
+    for (; arg_count > 1; arg_count --) {
+      append_char(buf, len);
+    }
+    append_char(buf, len);
+  } else if (this_key == CONTROL('I')) {
+    append_normalchar(TAB);
+  }
+}
+
+static void
+cmd_top_of_text()
+{
+  move_top_of_text();
+  while (curbuf->cold.head_size > 0 && thaw(0)) {
+    move_top_of_text();
+  }
+}
+
+static void
+cmd_end_of_text()
+{
+  move_end_of_text();
+  while (curbuf->cold.tail_size > 0 && thaw(1)) {
+    move_end_of_text();
+  }
+}
+
+/*
+ * Move to what find() gives from the cursor. The lines kept compressed
+ * come back on the way: the cursor stops where the text ends, so that
+ * the view keeps them. A search forward then goes on from the last line
+ * it read, and one backward starts again from where it started, which
+ * moved with the text.
+ */
+static void
+move_through(offset_t (*find)(offset_t), uint8_t tail)
+{
+  offset_t from = ed->cursor;
+  offset_t offset = find(from);
+  uint32_t *cold_size = tail ? &curbuf->cold.tail_size : &curbuf->cold.head_size;
+  while (offset == (tail ? ed->numtext : 0) && *cold_size > 0) {
+    move_to(offset);
+    offset_t before = ed->cursor;
+    if (!thaw(tail)) {
+      return;
+    }
+    if (tail) {
+      from = (ed->cursor > 0) ? ed->cursor - 1 : 0;
+    } else {
+      from = min(from + ed->cursor - before, ed->numtext);
+    }
+    offset = find(from);
+  }
+  move_to(offset);
+}
+
+static void
+cmd_forward_word()
+{
+  move_through(get_word_end, 1);
+}
+
+static void
+cmd_backward_word()
+{
+  move_through(get_word_start, 0);
+}
+
+static void
+cmd_forward_paragraph()
+{
+  move_through(get_paragraph_end, 1);
+}
+
+static void
+cmd_backward_paragraph()
+{
+  move_through(get_paragraph_start, 0);
+}
+
+/* a kill just after another one is added to it */
+static int
+after_kill()
+{
+  return last_command == CMD_KILL_LINE || last_command == CMD_KILL_WORD || last_command == CMD_KILL_REGION;
+}
+
+static void
+cmd_kill_line()
+{
+  offset_t end = get_line_end(ed->cursor);
+  if (end > ed->cursor + 1 && ed->text[end - 1] == LF) {
+    end --;
+  }
+  if (!kill_text(ed->cursor, end, after_kill())) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  kill_line();
+}
+
+static void
+cmd_kill_word()
+{
+  offset_t end = get_word_end(ed->cursor);
+  if (!kill_text(ed->cursor, end, after_kill())) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  delete_text(ed->cursor, end);
+}
+
+static void
+cmd_backward_kill_word()
+{
+  offset_t start = get_word_start(ed->cursor);
+  if (!kill_text(start, ed->cursor, 0)) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  delete_text(start, ed->cursor);
+}
+
+static void
+cmd_set_mark()
+{
+  set_mark();
+  show_message("Mark set");
+}
+
+static void
+cmd_kill_region()
+{
+  offset_t start, end;
+  if (!get_region(&start, &end)
+      || !kill_text(start, end, after_kill())) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  delete_text(start, end);
+}
+
+static void
+cmd_copy_region()
+{
+  offset_t start, end;
+  if (get_region(&start, &end) && kill_text(start, end, 0)) {
+    show_message("Copied");
+  }
+}
+
+static void
+cmd_yank()
+{
+  yank_index = 0;
+  if (!yank(yank_index)) {
+    this_command = CMD_IGNORE;
+  }
+}
+
+static void
+cmd_yank_pop()
+{
+  if (last_command != CMD_YANK && last_command != CMD_YANK_POP) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  delete_text(ed->mark, ed->cursor);
+  yank_index = (yank_index + 1) % kr_count();
+  if (!yank(yank_index)) {
+    this_command = CMD_IGNORE;
+  }
+}
+
+static void
+cmd_move_lines_up()
+{
+  move_lines(0);
+}
+
+static void
+cmd_move_lines_down()
+{
+  move_lines(1);
+}
+
+static void
+cmd_indent()
+{
+  indent_lines(0);
+}
+
+static void
+cmd_dedent()
+{
+  indent_lines(1);
+}
+
+/*
+ * Pass the region, or the whole text without one, to a Python callable
+ * in bytes of up to FILTER_CHUNK, then once more with None. What it
+ * returns for each call is written back in place of the input, so no
+ * copy of the whole text is made. A chunk is a copy because the text
+ * can move while the filter writes back, and the callable may keep it.
+ */
+static void
+cmd_filter()
+{
+  uint8_t index = last_filter;
+  for (int i = 0; i < overlay_count; i ++) {
+    if (overlay[i].key == this_key && overlay[i].filter != NO_FILTER) {
+      index = overlay[i].filter;
+    }
+  }
+  mp_obj_t entry = MP_STATE_VM(editor_filters)[index];
+  if (entry == MP_OBJ_NULL) {
+    show_message("*** No filter ***");
+    return;
+  }
+  offset_t start, end;
+  if (!get_region(&start, &end)) {
+    if (curbuf->cold.head_size > 0 || curbuf->cold.tail_size > 0) {
+      show_message("*** Compressed text needs a region ***");
+      return;
+    }
+    start = 0;
+    end = ed->numtext;
+  }
+  size_t len;
+  mp_obj_t *items;
+  mp_obj_get_array(entry, &len, &items);
+  uint8_t done = 1;
+  filter_start(start, end);
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    offset_t size;
+    do {
+      size = FILTER_CHUNK;
+      const uint8_t *src = filter_next(&size);
+      mp_obj_t chunk = size > 0 ? mp_obj_new_bytes(src, size) : mp_const_none;
+      mp_obj_t result = mp_call_function_1(items[1], chunk);
+      if (result != mp_const_none) {
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(result, &bufinfo, MP_BUFFER_READ);
+        done = filter_put((const uint8_t *) bufinfo.buf, bufinfo.len);
+      }
+    } while (size > 0 && done);
+    nlr_pop();
+  } else {
+    /* what was filtered so far stays */
+    done = 0;
+  }
+  filter_end(done);
+  if (!done) {
+    show_message("*** Filter stopped ***");
+  }
+}
+
+/* the count is for the replay, not for running this again */
+static void
+cmd_replay_macro()
+{
+  replay_macro(arg_count);
+  arg_count = 1;
+}
+
+static void
+cmd_repeat()
+{
+  int key;
+  arg_count = read_count(&key);
+  run_key(key);
+}
+
+static void
+cmd_redraw()
+{
+  redraw_windows = 1;
+}
+
+static void
+cmd_quit()
+{
+  editor_exit = EXIT_QUIT;
+}
+
+static int
+ask(const char *question)
+{
+  show_message(question);
+  int key = read_key();
+  show_message("");
+  return key == 'y' || key == 'Y';
+}
+
+/* a file that changed on flash is not overwritten without asking */
+static void
+cmd_save_and_quit()
+{
+  for (int i = 0; i < buffer_count; i ++) {
+    buffer_t *buffer = &buffers[i];
+    if ((buffer->ed.dirty_from != NOLINE || buffer->ed.saved_size == 0) && file_changed(buffer)
+        && !ask("File changed on flash, overwrite? (y/n) ")) {
+      return;
+    }
+  }
+  editor_exit = EXIT_SAVE;
+}
+
+static void
+cmd_reload()
+{
+  if (curbuf->cold.head_size > 0 || curbuf->cold.tail_size > 0) {
+    show_message("*** Compressed text is not reloaded ***");
+    return;
+  }
+  if (!file_changed(curbuf)) {
+    show_message("File unchanged");
+    return;
+  }
+  if (ed->modified && !ask("Discard changes? (y/n) ")) {
+    return;
+  }
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    reload_file(curbuf->filename);
+    nlr_pop();
+  } else {
+    show_message("*** Reload failed ***");
+  }
+}
+
+static void
+cmd_next_buffer()
+{
+  buffer_t *buffer = other_buffer();
+  if (buffer == NULL) {
+    show_message("*** No other buffer ***");
+    return;
+  }
+  save_views();
+  show_buffer(window, buffer);
+}
+
+static void
+cmd_split_window()
+{
+  buffer_t *buffer = other_buffer();
+  if (buffer == NULL) {
+    show_message("*** No other buffer ***");
+    return;
+  }
+  /* each window keeps two rows at least, as scrolling needs */
+  if (window_count == MAX_WINDOWS || editor_rows < 3 * (window_count + 1)) {
+    return;
+  }
+  save_views();
+  windows[window_count ++].buffer = buffer;
+  layout_windows();
+}
+
+static void
+cmd_other_window()
+{
+  window = (window + 1) % window_count;
+  select_buffer(windows[window].buffer);
+  /* what a replay left in the other window is not pending any more */
+  if (replaying) {
+    redraw_windows = 1;
+  }
+}
+
+static void
+cmd_one_window()
+{
+  if (window_count == 1) {
+    return;
+  }
+  save_views();
+  windows[0].buffer = curbuf;
+  window_count = 1;
+  window = 0;
+  layout_windows();
+}
+
+static void
+cmd_cx_prefix()
+{
+  show_message("C-x- ");
+  int key = read_key();
+  show_message("");
+  if (key < 0 || key >= 0200) {
+    this_command = CMD_IGNORE;
+    return;
+  }
+  run_key(KEY_CX(key));
+}
+
+static const struct {
+  const char *name;
+  void (*func)();
+} commands[CMD_COUNT] = {
+  { "ignore", cmd_ignore },
+  { "self-insert", cmd_self_insert },
+  { "forward-char", move_right },
+  { "backward-char", move_left },
+  { "previous-line", move_up },
+  { "next-line", move_down },
+  { "beginning-of-line", move_top_of_line },
+  { "end-of-line", move_end_of_line },
+  { "beginning-of-text", cmd_top_of_text },
+  { "end-of-text", cmd_end_of_text },
+  { "page-up", do_scroll_up },
+  { "page-down", do_scroll_down },
+  { "forward-word", cmd_forward_word },
+  { "backward-word", cmd_backward_word },
+  { "forward-paragraph", cmd_forward_paragraph },
+  { "backward-paragraph", cmd_backward_paragraph },
+  { "newline", append_newline },
+  { "delete-char", delete_char },
+  { "backspace", backspace_char },
+  { "kill-line", cmd_kill_line },
+  { "kill-word", cmd_kill_word },
+  { "backward-kill-word", cmd_backward_kill_word },
+  { "set-mark", cmd_set_mark },
+  { "exchange-mark", exchange_mark },
+  { "kill-region", cmd_kill_region },
+  { "copy-region", cmd_copy_region },
+  { "yank", cmd_yank },
+  { "yank-pop", cmd_yank_pop },
+  { "duplicate", duplicate_region },
+  { "move-lines-up", cmd_move_lines_up },
+  { "move-lines-down", cmd_move_lines_down },
+  { "indent", cmd_indent },
+  { "dedent", cmd_dedent },
+  { "comment", comment_lines },
+  { "filter", cmd_filter },
+  { "start-macro", start_macro },
+  { "end-macro", end_macro },
+  { "replay-macro", cmd_replay_macro },
+  { "repeat", cmd_repeat },
+  { "redraw", cmd_redraw },
+  { "show-status", show_status },
+  { "quit", cmd_quit },
+  { "save-and-quit", cmd_save_and_quit },
+  { "reload", cmd_reload },
+  { "next-buffer", cmd_next_buffer },
+  { "split-window", cmd_split_window },
+  { "other-window", cmd_other_window },
+  { "one-window", cmd_one_window },
+  { "cx-prefix", cmd_cx_prefix },
+};
+
+static uint8_t
+lookup_key(int key)
+{
+  for (int i = 0; i < overlay_count; i ++) {
+    if (overlay[i].key == key) {
+      return overlay[i].command;
+    }
+  }
+  uint8_t command = CMD_IGNORE;
+  if (key >= KEY_CX(0)) {
+    if (key < KEY_CX(0200)) {
+      command = cx_keymap[key - KEY_CX(0)];
+    }
+    return command;
+  }
+  if (key >= KEY_META(0) && key < KEY_META(0200)) {
+    command = keymap[META_INDEX(key - KEY_META(0))];
+  } else if (key >= 0 && key < KEYMAP_SIZE && (key < 0200 || key >= 0400)) {
+    command = keymap[key];
+  }
+  if (command == CMD_IGNORE && ((key >= ' ' && key < 0x80) || (key >= 0xC0 && key < 0xF8))) {
+    command = CMD_SELF_INSERT;
+  }
+  return command;
+}
+
+/* run the command bound to key, arg_count times unless it takes the count */
+static void
+run_key(int key)
+{
+  this_key = key;
+  this_command = lookup_key(key);
+  for (size_t i = 0; curbuf->read_only && i < sizeof editing_commands; i ++) {
+    if (this_command == editing_commands[i]) {
+      show_message("*** Read only ***");
+      this_command = CMD_IGNORE;
+    }
+  }
+  while (1) {
+    (*commands[this_command].func)();
+    cold_balance();
+    if (arg_count <= 1 || editor_exit) {
+      break;
+    }
+    arg_count --;
+    last_command = this_command;
+  }
+  arg_count = 1;
+}
+
+#ifndef __linux__
+extern int mp_interrupt_char;
+#endif
+
+int
+editor_main()
+{
+#ifndef __linux__
+  int interrupt_char = mp_interrupt_char;
+#endif
+
+  editor_exit = EXIT_NONE;
+  last_command = CMD_IGNORE;
+  pushed_key = -1;
+  arg_count = 1;
+  while (!editor_exit) {
+    key_start = macro_length;
+    int key = next_key();
+    clear_message();
+    run_key(key);
+    last_command = this_command;
+  }
+#ifndef __linux__
+  mp_interrupt_char = interrupt_char;
+#endif
+  return editor_exit == EXIT_SAVE;
+}
+
+static offset_t
+get_file_size(const char *filename)
+{
+  mp_obj_t path = mp_obj_new_str(filename, strlen(filename));
+  mp_obj_t stat;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    stat = mp_vfs_stat(path);
+    nlr_pop();
+  } else {
+    // new file
+    return 0;
+  }
+
+  size_t len;
+  mp_obj_t *items;
+  mp_obj_get_array(stat, &len, &items);
+  mp_int_t size = mp_obj_get_int(items[6]);
+  return size > MAX_TEXT ? MAX_TEXT : size;
+}
+
+static mp_int_t
+get_file_time(mp_obj_t path)
+{
+  mp_obj_t stat;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    stat = mp_vfs_stat(path);
+    nlr_pop();
+  } else {
+    return -1;
+  }
+
+  size_t len;
+  mp_obj_t *items;
+  mp_obj_get_array(stat, &len, &items);
+  return mp_obj_get_int(items[8]);
+}
+
+static void
+note_file(buffer_t *buffer)
+{
+  buffer->file_size = get_file_size(buffer->filename);
+  buffer->file_time = get_file_time(mp_obj_new_str(buffer->filename, strlen(buffer->filename)));
+}
+
+static int
+file_changed(buffer_t *buffer)
+{
+  return get_file_size(buffer->filename) != buffer->file_size
+    || get_file_time(mp_obj_new_str(buffer->filename, strlen(buffer->filename))) != buffer->file_time;
+}
+
+/* with compression the lines read first make room for the rest */
+static int
+import_text(const uint8_t *buf, uint16_t len)
+{
+  while (curbuf->cold.enabled && !reserve_text(len + COLD_SLACK) && cold_freeze_head(ed->numtext)) {
+  }
+  return import_data(buf, len);
+}
+
+static void
+read_file(const char *filename)
+{
+  mp_obj_t args[2] = {
+    mp_obj_new_str(filename, strlen(filename)),
+    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+  };
+
+  mp_obj_t file;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+    nlr_pop();
+  } else {
+    // new file
+    return;
+  }
+
+  int errcode;
+  byte buf[64];
+  uint16_t len;
+  uint32_t count = 1;
+  do {
+	len = mp_stream_rw(file, buf, sizeof buf, &errcode, MP_STREAM_RW_READ | MP_STREAM_RW_ONCE);
+	if (errcode != 0) {
+	  mp_raise_OSError(errcode);
+	}
+	for (int i = 0; i < len; i ++) {
+	  count += (buf[i] == LF);
+	}
+	if (len) {
+	  if (!import_text((const uint8_t *) buf, len)) {
+		show_message("*** Insufficient buffer size! ***");
+		break;
+	  }
+	}
+  } while (len);
+  mp_stream_close(file);
+
+  setup_gutter(count);
+  import_end();
+  return;
+}
+
+static void
+write_file(const char *filename, const uint8_t *buf, offset_t size)
+{
+  mp_obj_t args[2] = {
+    mp_obj_new_str(filename, strlen(filename)),
+    MP_OBJ_NEW_QSTR(MP_QSTR_wb),
+  };
+
+  mp_obj_t file;
+  file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+
+  int errcode;
+  mp_stream_rw(file, (byte *) buf, size, &errcode, MP_STREAM_RW_WRITE | MP_STREAM_RW_ONCE);
+  if (errcode != 0) {
+    mp_raise_OSError(errcode);
+  }
+
+  mp_stream_close(file);
+}
+
+static void
+write_stream(mp_obj_t file, const uint8_t *buf, offset_t size)
+{
+  int errcode;
+  mp_stream_rw(file, (byte *) buf, size, &errcode, MP_STREAM_RW_WRITE);
+  if (errcode != 0) {
+    mp_raise_OSError(errcode);
+  }
+}
+
+/* the compressed lines go out a chunk at a time through the scratch area */
+static void
+write_cold(mp_obj_t file, uint8_t tail)
+{
+  offset_t size;
+  for (uint16_t i = 0; (size = cold_unpack(tail, i)) > 0; i ++) {
+    write_stream(file, cold_scratch(), size);
+  }
+}
+
+static void
+write_text(mp_obj_t file)
+{
+  write_cold(file, 0);
+  write_stream(file, ed->text, ed->numtext);
+  write_cold(file, 1);
+}
+
+static void
+seek_file(mp_obj_t file, mp_off_t offset)
+{
+  const mp_stream_p_t *stream_p = mp_get_stream(file);
+  struct mp_stream_seek_t seek_s;
+  seek_s.offset = offset;
+  seek_s.whence = MP_SEEK_SET;
+  int errcode;
+  if (stream_p->ioctl(file, MP_STREAM_SEEK, (uintptr_t) &seek_s, &errcode) == MP_STREAM_ERROR) {
+    mp_raise_OSError(errcode);
+  }
+}
+
+static void
+flush_file(mp_obj_t file)
+{
+  const mp_stream_p_t *stream_p = mp_get_stream(file);
+  int errcode;
+  if (stream_p->ioctl(file, MP_STREAM_FLUSH, 0, &errcode) == MP_STREAM_ERROR) {
+    mp_raise_OSError(errcode);
+  }
+}
+
+static offset_t
+read_block(mp_obj_t file, mp_off_t offset, byte *buf, offset_t size)
+{
+  int errcode;
+  seek_file(file, offset);
+  offset_t len = mp_stream_rw(file, buf, size, &errcode, MP_STREAM_RW_READ);
+  if (errcode != 0) {
+    mp_raise_OSError(errcode);
+  }
+  return len;
+}
+
+/*
+ * Read the file again after it changed on flash. It is compared with
+ * the text a block at a time from the start and from the end, and only
+ * what is between the first and the last difference is read into the
+ * text, which then becomes the region. It is read into the free end of
+ * the buffer first, so a read that fails leaves the text as it was.
+ */
+static void
+reload_file(const char *filename)
+{
+  mp_obj_t args[2] = {
+    mp_obj_new_str(filename, strlen(filename)),
+    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+  };
+  mp_obj_t file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+  offset_t size = get_file_size(filename);
+  byte buf[64];
+  offset_t head = 0, tail = 0, len;
+
+  while (head < size && head < ed->numtext) {
+    len = read_block(file, head, buf, min((offset_t) sizeof buf, size - head));
+    offset_t i = 0;
+    while (i < len && head < ed->numtext && buf[i] == ed->text[head]) {
+      i ++;
+      head ++;
+    }
+    if (i < len || len == 0) {
+      break;
+    }
+  }
+  offset_t limit = min(size, ed->numtext) - head;
+  while (tail < limit) {
+    len = min((offset_t) sizeof buf, limit - tail);
+    if (read_block(file, size - tail - len, buf, len) < len) {
+      break;
+    }
+    offset_t i = len;
+    while (i > 0 && buf[i - 1] == ed->text[ed->numtext - tail - 1]) {
+      i --;
+      tail ++;
+    }
+    if (i > 0) {
+      break;
+    }
+  }
+
+  offset_t removed = ed->numtext - tail - head, added = size - tail - head;
+  if (removed == 0 && added == 0) {
+    mp_stream_close(file);
+    mark_saved();
+    note_file(curbuf);
+    return;
+  }
+  if (!reserve_text((added > removed ? added - removed : 0) + added)) {
+    mp_stream_close(file);
+    show_message("*** Insufficient buffer size! ***");
+    return;
+  }
+  /* past the end of the text even after it has grown */
+  uint8_t *fresh = ed->text + ed->maxtext - added;
+  int errcode = 0;
+  seek_file(file, head);
+  len = (added > 0) ? mp_stream_rw(file, fresh, added, &errcode, MP_STREAM_RW_READ) : 0;
+  mp_stream_close(file);
+  if (errcode != 0 || len < added) {
+    show_message("*** Reload failed ***");
+    return;
+  }
+  filter_start(head, ed->numtext - tail);
+  filter_next(&removed);
+  filter_put(fresh, added);
+  filter_end(1);
+  mark_saved();
+  note_file(curbuf);
+}
+
+static int
+update_file(const char *filename, const uint8_t *buf, offset_t from, offset_t size)
+{
+  mp_obj_t args[2] = {
+    mp_obj_new_str(filename, strlen(filename)),
+    mp_obj_new_str("r+b", 3),
+  };
+
+  mp_obj_t file;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+    nlr_pop();
+  } else {
+    return 0;
+  }
+
+  int errcode;
+  seek_file(file, from);
+  mp_stream_rw(file, (byte *) buf + from, size - from, &errcode, MP_STREAM_RW_WRITE);
+  if (errcode != 0) {
+    mp_raise_OSError(errcode);
+  }
+
+  mp_stream_close(file);
+  return 1;
+}
+
+/* the room grown while editing goes back to the arena */
+static void
+file_saved()
+{
+  mark_saved();
+  note_file(curbuf);
+  fit_buffer();
+}
+
+/*
+ * Rewrite the file from the flash block holding the first change. The
+ * prefix on flash is kept as it is; a file that would shrink, that
+ * changed on flash since it was read, or whose lines were compressed
+ * since it was saved, is written as a whole.
+ */
+static void
+save_file(const char *filename)
+{
+  const uint8_t *buf = ed->text;
+  offset_t from = ed->dirty_from;
+  if (from == NOLINE && ed->saved_size > 0) {
+    return;
+  }
+  if (curbuf->cold.shifted) {
+    mp_obj_t args[2] = {
+      mp_obj_new_str(filename, strlen(filename)),
+      MP_OBJ_NEW_QSTR(MP_QSTR_wb),
+    };
+    mp_obj_t file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+    write_text(file);
+    mp_stream_close(file);
+    file_saved();
+    /* the text is the whole file again once nothing is compressed */
+    curbuf->cold.shifted = curbuf->cold.head_size > 0 || curbuf->cold.tail_size > 0;
+    return;
+  }
+  if (ed->numtext >= ed->saved_size && from >= SAVE_BLOCK_SIZE
+      && get_file_size(filename) == ed->saved_size && !file_changed(curbuf)) {
+    from -= from % SAVE_BLOCK_SIZE;
+    if (update_file(filename, buf, from, ed->numtext)) {
+      file_saved();
+      return;
+    }
+  }
+  write_file(filename, buf, ed->numtext);
+  file_saved();
+}
+
+/*
+ * Autosave: after autosave_time seconds without a key the text is
+ * written to <filename>.sav, AUTOSAVE_CHUNK bytes at a time as long as
+ * no key arrives. Later cycles rewrite only from the first change, and
+ * the length in the header is written last, so trailing bytes left by
+ * a shorter text do not matter. Until then the header holds 0, so a
+ * cycle cut short by a power loss leaves no file to recover from.
+ */
+
+static mp_obj_t
+recovery_path(const char *filename)
+{
+  size_t len = strlen(filename);
+  char *path = m_new(char, len + sizeof RECOVERY_SUFFIX);
+  memcpy(path, filename, len);
+  memcpy(path + len, RECOVERY_SUFFIX, sizeof RECOVERY_SUFFIX);
+  mp_obj_t obj = mp_obj_new_str(path, len + sizeof RECOVERY_SUFFIX - 1);
+  m_del(char, path, len + sizeof RECOVERY_SUFFIX);
+  return obj;
+}
+
+static void
+changed(offset_t offset)
+{
+  if (highlight) {
+    hl_changed(offset);
+  }
+  if (offset < curbuf->autosave_dirty) {
+    curbuf->autosave_dirty = offset;
+  }
+  if (saving == curbuf && offset < curbuf->autosave_pos) {
+    curbuf->autosave_pos = offset;
+    curbuf->autosave_seek = 1;
+  }
+}
+
+static void
+write_header(mp_obj_t file, uint32_t length)
+{
+  byte header[RECOVERY_HEADER];
+  int errcode;
+  for (int i = 0; i < RECOVERY_HEADER; i ++) {
+    header[i] = (length >> (i * 8)) & 0xFF;
+  }
+  seek_file(file, 0);
+  mp_stream_rw(file, header, RECOVERY_HEADER, &errcode, MP_STREAM_RW_WRITE);
+  if (errcode != 0) {
+    mp_raise_OSError(errcode);
+  }
+  flush_file(file);
+}
+
+static int
+autosave_step()
+{
+  mp_obj_t file = MP_STATE_VM(editor_autosave_file);
+  const uint8_t *buf = ed->text;
+  int errcode;
+  if (file == MP_OBJ_NULL) {
+    mp_obj_t args[2] = {
+      recovery_path(curbuf->filename),
+      mp_obj_new_str(curbuf->autosave_valid ? "r+b" : "wb", curbuf->autosave_valid ? 3 : 2),
+    };
+    file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+    MP_STATE_VM(editor_autosave_file) = file;
+    if (curbuf->autosave_valid) {
+      /* the old text is no longer whole once a part is rewritten */
+      write_header(file, 0);
+    }
+    saving = curbuf;
+    curbuf->autosave_pos = curbuf->autosave_valid ? curbuf->autosave_dirty : 0;
+    curbuf->autosave_seek = 1;
+  }
+  if (curbuf->cold.head_size > 0 || curbuf->cold.tail_size > 0) {
+    /* with the compressed lines it is written in one step */
+    seek_file(file, RECOVERY_HEADER);
+    write_text(file);
+    curbuf->autosave_pos = ed->numtext;
+    curbuf->autosave_seek = 0;
+  }
+  if (curbuf->autosave_seek) {
+    seek_file(file, RECOVERY_HEADER + curbuf->autosave_pos);
+    curbuf->autosave_seek = 0;
+  }
+  if (curbuf->autosave_pos < ed->numtext) {
+    offset_t count = min(ed->numtext - curbuf->autosave_pos, AUTOSAVE_CHUNK);
+    mp_stream_rw(file, (byte *) buf + curbuf->autosave_pos, count, &errcode, MP_STREAM_RW_WRITE);
+    if (errcode != 0) {
+      mp_raise_OSError(errcode);
+    }
+    curbuf->autosave_pos += count;
+    return 1;
+  }
+  /* all the text is there: the header makes it valid */
+  flush_file(file);
+  write_header(file, text_length());
+  MP_STATE_VM(editor_autosave_file) = MP_OBJ_NULL;
+  saving = NULL;
+  mp_stream_close(file);
+  curbuf->autosave_valid = 1;
+  curbuf->autosave_dirty = NOLINE;
+  return 0;
+}
+
+static buffer_t *
+autosave_next()
+{
+  if (saving != NULL) {
+    return saving;
+  }
+  /* a read-only buffer is never written, nor its recovery file touched */
+  for (int i = 0; i < buffer_count; i ++) {
+    if (buffers[i].autosave_dirty != NOLINE && !buffers[i].read_only) {
+      return &buffers[i];
+    }
+  }
+  return NULL;
+}
+
+/* the buffers are saved in turn, each one selected while it is written */
+static void
+autosave_idle()
+{
+  buffer_t *next = autosave_next();
+  if (autosave_time == 0 || next == NULL || pushed_key >= 0) {
+    return;
+  }
+  /* a cycle that was cut short goes on at once */
+  if (saving == NULL && wait_key(autosave_time * 1000)) {
+    return;
+  }
+  buffer_t *current = curbuf;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    while (next != NULL && !wait_key(0)) {
+      select_buffer(next);
+      if (!autosave_step()) {
+        next = autosave_next();
+      }
+    }
+    nlr_pop();
+  } else {
+    MP_STATE_VM(editor_autosave_file) = MP_OBJ_NULL;
+    saving = NULL;
+    autosave_time = 0;
+    show_message("*** Autosave failed ***");
+  }
+  select_buffer(current);
+}
+
+static void
+autosave_start()
+{
+  MP_STATE_VM(editor_autosave_file) = MP_OBJ_NULL;
+  saving = NULL;
+  for (int i = 0; i < buffer_count; i ++) {
+    buffers[i].autosave_valid = 0;
+    buffers[i].autosave_dirty = NOLINE;
+  }
+}
+
+static void
+remove_recovery(const char *filename)
+{
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    mp_vfs_remove(recovery_path(filename));
+    nlr_pop();
+  }
+}
+
+static void
+autosave_stop()
+{
+  mp_obj_t file = MP_STATE_VM(editor_autosave_file);
+  MP_STATE_VM(editor_autosave_file) = MP_OBJ_NULL;
+  saving = NULL;
+  nlr_buf_t nlr;
+  if (file != MP_OBJ_NULL && nlr_push(&nlr) == 0) {
+    mp_stream_close(file);
+    nlr_pop();
+  }
+}
+
+static void
+autosave_end()
+{
+  autosave_stop();
+  for (int i = 0; i < buffer_count; i ++) {
+    remove_recovery(buffers[i].filename);
+  }
+}
+
+/* asks only for a file that was written whole */
+static int
+read_recovery(mp_obj_t path)
+{
+  mp_obj_t args[2] = {
+    path,
+    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+  };
+
+  mp_obj_t file;
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    file = mp_vfs_open(MP_ARRAY_SIZE(args), &args[0], (mp_map_t *)&mp_const_empty_map);
+    nlr_pop();
+  } else {
+    return 0;
+  }
+
+  int errcode;
+  byte buf[64];
+  uint32_t size = 0;
+  uint16_t len = mp_stream_rw(file, buf, RECOVERY_HEADER, &errcode, MP_STREAM_RW_READ);
+  if (errcode != 0 || len < RECOVERY_HEADER) {
+    mp_stream_close(file);
+    return 0;
+  }
+  for (int i = RECOVERY_HEADER; i -- > 0; ) {
+    size = (size << 8) | buf[i];
+  }
+  if (size == 0) {
+    /* it was being written */
+    mp_stream_close(file);
+    return 0;
+  }
+  show_message("Recover from autosave? (y/n) ");
+  int ch = getch();
+  show_message("");
+  if (ch != 'y' && ch != 'Y') {
+    mp_stream_close(file);
+    return 0;
+  }
+  uint32_t count = 1;
+  /* the recovered text replaces the lines kept compressed too */
+  ed->maxtext += curbuf->cold.head_size + curbuf->cold.tail_size;
+  cold_init(curbuf->cold.enabled);
+  import_start();
+  while (size) {
+	len = mp_stream_rw(file, buf, min(size, sizeof buf), &errcode, MP_STREAM_RW_READ | MP_STREAM_RW_ONCE);
+	if (errcode != 0 || len == 0) {
+	  break;
+	}
+	for (int i = 0; i < len; i ++) {
+	  count += (buf[i] == LF);
+	}
+	if (!import_text((const uint8_t *) buf, len)) {
+	  show_message("*** Insufficient buffer size! ***");
+	  break;
+	}
+	size -= len;
+  }
+  mp_stream_close(file);
+
+  setup_gutter(count);
+  import_end();
+  /* the file on flash is older than the text */
+  ed->dirty_from = 0;
+  ed->modified = 1;
+  return 1;
+}
+
+static void
+offer_recovery(const char *filename)
+{
+  mp_obj_t path = recovery_path(filename);
+  mp_int_t saved = get_file_time(path);
+  if (saved < 0 || saved < get_file_time(mp_obj_new_str(filename, strlen(filename)))) {
+    return;
+  }
+  read_recovery(path);
+}
+
+/*
+ * The buffers share one arena: their texts follow each other in the
+ * order they were opened, with the free space at the end. A text that
+ * grows moves the ones after it; only an arena on the heap can grow.
+ * The compressed lines of a buffer follow its text.
+ */
+
+static size_t
+arena_used()
+{
+  const buffer_t *last = &buffers[buffer_count - 1];
+  return last->ed.text + last->ed.maxtext + 2 + cold_extent(&last->cold) - MP_STATE_VM(editor_buffer);
+}
+
+static void
+place_buffers()
+{
+  uint8_t *p = MP_STATE_VM(editor_buffer);
+  for (int i = 0; i < buffer_count; i ++) {
+    buffers[i].ed.text = p;
+    p += buffers[i].ed.maxtext + 2 + cold_extent(&buffers[i].cold);
+  }
+}
+
+static int
+grow_arena(size_t size)
+{
+  if (buffer_fixed) {
+    return 0;
+  }
+#if MICROPY_MALLOC_USES_ALLOCATED_SIZE
+  uint8_t *p = (uint8_t *) m_realloc_maybe(MP_STATE_VM(editor_buffer), buffer_size, size, true);
+#else /* MICROPY_MALLOC_USES_ALLOCATED_SIZE */
+  uint8_t *p = (uint8_t *) m_realloc_maybe(MP_STATE_VM(editor_buffer), size, true);
+#endif /* MICROPY_MALLOC_USES_ALLOCATED_SIZE */
+  if (p == NULL) {
+    return 0;
+  }
+  MP_STATE_VM(editor_buffer) = p;
+  buffer_size = size;
+  place_buffers();
+  return 1;
+}
+
+static uint8_t *
+resize_buffer(offset_t *size)
+{
+  size_t start = ed->text - MP_STATE_VM(editor_buffer);
+  size_t end = start + ed->maxtext + 2;
+  size_t used = arena_used();
+  size_t needed = used - end + start + *size;
+  if (needed > buffer_size && !grow_arena(needed)) {
+    return NULL;
+  }
+  uint8_t *base = MP_STATE_VM(editor_buffer);
+  memmove(base + start + *size, base + end, used - end);
+  ed->maxtext = *size - 2;
+  place_buffers();
+  return ed->text;
+}
+
+static offset_t
+text_size(offset_t hint)
+{
+  uint32_t size = (uint32_t) hint + 2 + BUFFER_CHUNK;
+  size -= size % BUFFER_CHUNK;
+  return size > MAX_TEXT ? MAX_TEXT : size;
+}
+
+/*
+ * Compression: a buffer that cannot grow any more keeps the lines far
+ * from the view compressed after its text. A screen of lines stays
+ * plain on either side of the view, and chunks come back as the view
+ * gets near them.
+ */
+
+/* where the plain lines kept around the view, the cursor and the mark end */
+static offset_t
+cold_limit(uint8_t tail, uint8_t keep_mark)
+{
+  offset_t offset = min(ed->lines[0], ed->cursor);
+  offset_t mark = keep_mark ? ed->mark : NOLINE;
+  if (!tail) {
+    if (mark != NOLINE) {
+      offset = min(offset, mark);
+    }
+    for (row_t i = 0; i < ed->rows && offset > 0; i ++) {
+      offset = get_line_start(offset - 1);
+    }
+    return offset;
+  }
+  offset = ed->lines[ed->rows - 1];
+  offset = (offset == NOLINE) ? ed->numtext : get_line_end(offset);
+  if (ed->cursor > offset) {
+    offset = ed->cursor;
+  }
+  if (mark != NOLINE && mark > offset) {
+    offset = mark;
+  }
+  for (row_t i = 0; i < ed->rows && offset < ed->numtext; i ++) {
+    offset = get_line_end(offset);
+  }
+  return offset;
+}
+
+/* the offsets in the text changed under autosave */
+static void
+cold_moved()
+{
+  curbuf->autosave_valid = 0;
+  if (curbuf->autosave_dirty != NOLINE) {
+    curbuf->autosave_dirty = 0;
+  }
+  if (saving == curbuf) {
+    curbuf->autosave_pos = 0;
+    curbuf->autosave_seek = 1;
+  }
+}
+
+/* compress a chunk from the side with more lines to spare */
+static int
+cold_freeze(uint8_t keep_mark)
+{
+  offset_t head = cold_limit(0, keep_mark);
+  offset_t tail = cold_limit(1, keep_mark);
+  if (head >= ed->numtext - tail) {
+    return cold_freeze_head(head) || cold_freeze_tail(tail);
+  }
+  return cold_freeze_tail(tail) || cold_freeze_head(head);
+}
+
+/* room for size bytes; the mark is given up only when nothing else is left */
+static int
+cold_room(offset_t size)
+{
+  while (!reserve_text(size)) {
+    if (!cold_freeze(1) && !cold_freeze(0)) {
+      return 0;
+    }
+    cold_moved();
+  }
+  return 1;
+}
+
+static int
+thaw(uint8_t tail)
+{
+  if (!cold_room(cold_next_raw(tail))) {
+    return 0;
+  }
+  if (!(tail ? cold_thaw_tail() : cold_thaw_head())) {
+    return 0;
+  }
+  cold_moved();
+  return 1;
+}
+
+/* after each command: plain lines around the view and room to edit */
+static void
+cold_balance()
+{
+  if (!curbuf->cold.enabled) {
+    return;
+  }
+  while (curbuf->cold.head_size > 0 && cold_limit(0, 0) == 0 && thaw(0)) {
+  }
+  while (curbuf->cold.tail_size > 0 && cold_limit(1, 0) == ed->numtext && thaw(1)) {
+  }
+  cold_room(COLD_SLACK);
+}
+
+static size_t
+carve_lines(uint8_t *base, size_t len)
+{
+  if (len < table_size + 16) {
+    mp_raise_ValueError(MP_ERROR_TEXT("buffer is too small."));
+  }
+  uintptr_t end = ((uintptr_t) base + len - table_size) & ~(uintptr_t) (sizeof(offset_t) - 1);
+  MP_STATE_VM(editor_lines) = (void *) end;
+  return end - (uintptr_t) base;
+}
+
+/* the line table, the highlight cache if enabled and the kill ring */
+static size_t
+line_table_size()
+{
+  size_t size = editor_rows * sizeof(offset_t);
+  if (highlight) {
+    size += hl_cache_size(editor_rows);
+  }
+  return size + KILL_RING_SIZE;
+}
+
+/* the least a buffer is opened in: with compression, the scratch and a chunk of text */
+static size_t
+least_room(uint8_t compressed)
+{
+  return compressed ? COLD_SCRATCH + BUFFER_CHUNK : 16;
+}
+
+/* whether a buffer that cannot grow leaves the least room after the line table */
+static int
+fits_fixed_buffer(mp_obj_t buffer_obj, uint8_t compressed)
+{
+  size_t len;
+  if (buffer_obj != MP_OBJ_NULL && buffer_obj != mp_const_none) {
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buffer_obj, &bufinfo, MP_BUFFER_WRITE);
+    len = bufinfo.len;
+  } else {
+#ifdef MODEDITOR_STATIC_BUFFER_SIZE
+    len = sizeof static_buffer;
+#else /* MODEDITOR_STATIC_BUFFER_SIZE */
+    return 1;
+#endif /* MODEDITOR_STATIC_BUFFER_SIZE */
+  }
+  return len >= line_table_size() + sizeof(offset_t) + least_room(compressed);
+}
+
+static size_t
+acquire_buffer(size_t size)
+{
+  table_size = line_table_size();
+  set_resize_func(resize_buffer);
+  buffer_fixed = 1;
+  mp_obj_t buffer_obj = MP_STATE_VM(editor_buffer_obj);
+  if (buffer_obj != MP_OBJ_NULL && buffer_obj != mp_const_none) {
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buffer_obj, &bufinfo, MP_BUFFER_WRITE);
+    MP_STATE_VM(editor_buffer) = (uint8_t *) bufinfo.buf;
+    buffer_size = carve_lines(MP_STATE_VM(editor_buffer), bufinfo.len);
+    return buffer_size;
+  }
+#ifdef MODEDITOR_STATIC_BUFFER_SIZE
+  MP_STATE_VM(editor_buffer) = static_buffer;
+  buffer_size = carve_lines(static_buffer, sizeof static_buffer);
+  return buffer_size;
+#else /* MODEDITOR_STATIC_BUFFER_SIZE */
+  MP_STATE_VM(editor_lines) = m_new(uint8_t, table_size);
+  buffer_size = size;
+  buffer_fixed = 0;
+  MP_STATE_VM(editor_buffer) = (uint8_t *) m_malloc(buffer_size);
+  return buffer_size;
+#endif /* MODEDITOR_STATIC_BUFFER_SIZE */
+}
+
+static void
+release_buffer()
+{
+#ifndef MODEDITOR_STATIC_BUFFER_SIZE
+  if (!buffer_fixed) {
+#if MICROPY_MALLOC_USES_ALLOCATED_SIZE
+    m_free(MP_STATE_VM(editor_buffer), buffer_size);
 #else /* MICROPY_MALLOC_USES_ALLOCATED_SIZE */
-  m_free(buffer);
+    m_free(MP_STATE_VM(editor_buffer));
 #endif /* MICROPY_MALLOC_USES_ALLOCATED_SIZE */
-  buffer = NULL;
+    m_del(uint8_t, MP_STATE_VM(editor_lines), table_size);
+  }
+#endif /* MODEDITOR_STATIC_BUFFER_SIZE */
+  MP_STATE_VM(editor_buffer) = NULL;
+  MP_STATE_VM(editor_lines) = NULL;
+  buffer_size = 0;
+  buffer_count = 0;
+}
+
+/* read a file into a new buffer, which takes the free space until it is read */
+static void
+open_buffer(const char *filename)
+{
+  size_t used = buffer_count ? arena_used() : 0;
+  size_t size = buffer_size - used;
+  size_t extent = compress ? COLD_SCRATCH : 0;
+  if (size < least_room(compress)) {
+    mp_raise_ValueError(MP_ERROR_TEXT("buffer is too small."));
+  }
+  size -= extent;
+  buffer_t *buffer = &buffers[buffer_count ++];
+  select_buffer(buffer);
+  cold_init(compress);
+  init_editor(&buffer->ed, MP_STATE_VM(editor_buffer) + used, size > MAX_TEXT ? MAX_TEXT : size,
+              (offset_t *) MP_STATE_VM(editor_lines), editor_rows, editor_columns);
+  buffer->filename = filename;
+  buffer->read_only = read_only;
+  hl_init(NULL);
+  setup_gutter(1);
+  read_file(filename);
+  note_file(buffer);
+  if (!read_only) {
+    offer_recovery(filename);
+  }
+  /* a file read through compression ends up at its last lines */
+  cmd_top_of_text();
+  cold_balance();
+  if (buffer->cold.head_size > 0) {
+    show_message("*** Insufficient buffer size! ***");
+  }
+  fit_buffer();
+  buffer->top = ed->lines[0];
+}
+
+/* whether each file can be opened in the space left by the ones before it */
+static int
+check_room(const offset_t *sizes, size_t count)
+{
+  size_t extent = compress ? COLD_SCRATCH : 0;
+  size_t used = 0;
+  for (size_t i = 0; i < count; i ++) {
+    size_t room = buffer_size - used;
+    if (room < least_room(compress)) {
+      return 0;
+    }
+    size_t needed = text_size(sizes[i]) + extent;
+    used += (needed < room) ? needed : room;
+  }
+  return 1;
+}
+
+/*
+ * After a session, or an exception out of it: the terminal is restored
+ * and the buffer freed. The recovery files are kept after an exception.
+ */
+static void
+end_session()
+{
+  autosave_stop();
+  recording = 0;
+  replaying = 0;
+  move(editor_rows, 0);
+  endwin();
+  deinit_term();
+  release_buffer();
+}
+
+static void
+edit_session(const char **filenames, size_t count)
+{
+  initscr();
+  clear();
+  move(0,0);
+  status_shown[0] = NUL;
+  for (size_t i = 0; i < count; i ++) {
+    open_buffer(filenames[i]);
+  }
+  window_count = 1;
+  window = 0;
+  windows[0].buffer = &buffers[0];
+  layout_windows();
+  kr_init((uint8_t *) MP_STATE_VM(editor_lines) + table_size - KILL_RING_SIZE);
+  set_change_func(changed);
+  if (!read_only) {
+    autosave_start();
+  }
+  if (editor_main()) {
+    for (int i = 0; i < buffer_count; i ++) {
+      select_buffer(&buffers[i]);
+      if (!curbuf->read_only) {
+        save_file(buffers[i].filename);
+      }
+    }
+  }
+  if (!read_only) {
+    autosave_end();
+  }
+}
+
+static mp_obj_t
+edit_files(size_t n_args, const mp_obj_t *args, uint8_t _read_only)
+{
+  const char *filenames[MAX_BUFFERS];
+  offset_t sizes[MAX_BUFFERS];
+  size_t size = 0;
+  for (size_t i = 0; i < n_args; i ++) {
+    size_t filename_len = 0;
+    filenames[i] = get_string(args[i], &filename_len);
+    if (filename_len == 0) {
+      mp_raise_ValueError(MP_ERROR_TEXT("filename must not be empty."));
+    }
+    for (size_t j = 0; j < i; j ++) {
+      if (strcmp(filenames[i], filenames[j]) == 0) {
+        mp_raise_ValueError(MP_ERROR_TEXT("the same file is given twice."));
+      }
+    }
+    sizes[i] = get_file_size(filenames[i]);
+    size += text_size(sizes[i]);
+    if (compress) {
+      size += COLD_SCRATCH;
+    }
+  }
+  if (auto_screen) {
+    detect_screen();
+  }
+  read_only = _read_only;
+  acquire_buffer(size);
+  if (!check_room(sizes, n_args)) {
+    release_buffer();
+    mp_raise_ValueError(MP_ERROR_TEXT("buffer is too small."));
+  }
+
+  init_term();
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    edit_session(filenames, n_args);
+    nlr_pop();
+  } else {
+    end_session();
+    nlr_jump(nlr.ret_val);
+  }
+  end_session();
+  return mp_const_none;
+}
+
+STATIC mp_obj_t
+edit(size_t n_args, const mp_obj_t *args)
+{
+  return edit_files(n_args, args, 0);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(edit_obj, 1, MAX_BUFFERS, edit);
+
+static void
+follow_main(mp_obj_t file, int skip)
+{
+  int errcode;
+  byte buf[64];
+  uint16_t len;
+  row_t last = 0, delta = 0;
+  int pending = 0;
+
+  setscrreg(EDITOR_OFFSETY, EDITOR_OFFSETY + editor_rows - 1);
+  draw_rows(0);
+  while (1) {
+	len = mp_stream_rw(file, buf, sizeof buf, &errcode, MP_STREAM_RW_READ | MP_STREAM_RW_ONCE);
+	if (errcode != 0) {
+	  len = 0;
+	}
+	if (len) {
+	  const byte *src = buf;
+	  if (skip) {
+		/* started in the middle of the file: drop the partial line */
+		const byte *lf = memchr(buf, LF, len);
+		if (lf == NULL) {
+		  continue;
+		}
+		src = lf + 1;
+		len -= src - buf;
+		skip = 0;
+	  }
+	  if (!pending) {
+		last = editor_rows - 1;
+		while (last > 0 && get_top_of_line(last) == NULL) {
+		  last --;
+		}
+		delta = 0;
+		pending = 1;
+	  }
+	  append_data((const uint8_t *) src, len);
+	  delta += follow_end();
+	  continue;
+	}
+	if (pending) {
+	  /* move the old rows up in the terminal and draw only the new ones */
+	  if (delta >= editor_rows) {
+		ed->drawmode = DM_FULL;
+	  } else if (delta > 0 && ed->drawmode != DM_FULL) {
+		scrl(delta);
+	  }
+	  draw_rows(last > delta ? last - delta : 0);
+	  pending = 0;
+	}
+	if (!wait_key(FOLLOW_INTERVAL)) {
+	  continue;
+	}
+	int ch = getch();
+	if (ch == ESC || ch == 'q') {
+	  break;
+	} else if (ch == CONTROL('G')) {
+	  ed->drawmode = DM_FULL;
+	  draw_rows(0);
+	}
+  }
+}
+
+/* from start, or from the line after it in the middle of the file */
+static void
+follow_session(const char *filename, mp_obj_t file, offset_t size, offset_t start)
+{
+  if (start > 0) {
+    seek_file(file, start);
+  }
+  initscr();
+  clear();
+  buffer_count = 1;
+  window_count = 1;
+  window = 0;
+  windows[0].buffer = &buffers[0];
+  screen_top = 0;
+  select_buffer(&buffers[0]);
+  cold_init(0);
+  init_editor(&curbuf->ed, MP_STATE_VM(editor_buffer), size, (offset_t *) MP_STATE_VM(editor_lines), editor_rows, editor_columns);
+  curbuf->filename = filename;
+  status_shown[0] = NUL;
+  setup_gutter(1);
+  import_end();
+  hl_init(highlight ? (offset_t *) MP_STATE_VM(editor_lines) + editor_rows : NULL);
+  set_change_func(highlight ? hl_changed : NULL);
+  follow_main(file, start > 0);
+}
+
+STATIC mp_obj_t
+follow(size_t n_args, const mp_obj_t *args)
+{
+  size_t filename_len = 0;
+  const char *filename = get_string(args[0], &filename_len);
+  if (filename_len == 0) {
+    mp_raise_ValueError(MP_ERROR_TEXT("filename must not be empty."));
+  }
+  offset_t limit = FOLLOW_BUFFER_SIZE;
+  if (n_args > 1) {
+    mp_int_t size = mp_obj_get_int(args[1]);
+    if (size < BUFFER_CHUNK * 2 || size > MAX_TEXT) {
+      mp_raise_ValueError(MP_ERROR_TEXT("size is out of range."));
+    }
+    limit = size;
+  }
+  mp_obj_t open_args[2] = {
+    mp_obj_new_str(filename, filename_len),
+    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+  };
+  mp_obj_t file = mp_vfs_open(MP_ARRAY_SIZE(open_args), &open_args[0], (mp_map_t *)&mp_const_empty_map);
+  offset_t file_size = get_file_size(filename);
+  if (auto_screen) {
+    detect_screen();
+  }
+  size_t arena = acquire_buffer(text_size(limit - BUFFER_CHUNK));
+  offset_t size = arena > MAX_TEXT ? MAX_TEXT : arena;
+  /* a fixed size: the oldest lines are dropped instead */
+  set_resize_func(NULL);
+
+  init_term();
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    follow_session(filename, file, size, (file_size > size / 2) ? file_size - size / 2 : 0);
+    nlr_pop();
+  } else {
+    end_session();
+    mp_stream_close(file);
+    nlr_jump(nlr.ret_val);
+  }
+  end_session();
+  mp_stream_close(file);
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(follow_obj, 1, 2, follow);
+
+static void
+view_session(const char *filename, const uint8_t *text, offset_t size, uint32_t count)
+{
+  initscr();
+  clear();
+  buffer_count = 1;
+  window_count = 1;
+  window = 0;
+  windows[0].buffer = &buffers[0];
+  screen_top = 0;
+  select_buffer(&buffers[0]);
+  cold_init(0);
+  init_mapped(&curbuf->ed, text, size, (offset_t *) MP_STATE_VM(editor_lines), editor_rows, editor_columns);
+  curbuf->filename = filename;
+  curbuf->read_only = read_only = 1;
+  curbuf->top = 0;
+  status_shown[0] = NUL;
+  setup_gutter(count);
+  layout_windows();
+  kr_init((uint8_t *) MP_STATE_VM(editor_lines) + table_size - KILL_RING_SIZE);
+  set_change_func(changed);
+  editor_main();
+}
+
+/* only the line table is allocated: the text stays where it is mapped */
+static void
+view_mapped(const char *filename, const uint8_t *text, offset_t size)
+{
+  if (auto_screen) {
+    detect_screen();
+  }
+  acquire_buffer(0);
+  set_resize_func(NULL);
+  uint32_t count = 1;
+  for (offset_t i = 0; i < size; i ++) {
+    count += (text[i] == LF);
+  }
+
+  init_term();
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    view_session(filename, text, size, count);
+    nlr_pop();
+  } else {
+    end_session();
+    nlr_jump(nlr.ret_val);
+  }
+  end_session();
+}
+
+/*
+ * Show a file read-only. A file on a filesystem mapped into memory, such
+ * as a ROM image, that ends with a LF is shown in place; any other file
+ * is read into the buffer as edit() does.
+ */
+STATIC mp_obj_t
+view(mp_obj_t filename_obj)
+{
+  size_t filename_len = 0;
+  const char *filename = get_string(filename_obj, &filename_len);
+  if (filename_len == 0) {
+    mp_raise_ValueError(MP_ERROR_TEXT("filename must not be empty."));
+  }
+  mp_obj_t open_args[2] = {
+    filename_obj,
+    MP_OBJ_NEW_QSTR(MP_QSTR_rb),
+  };
+  mp_obj_t file = mp_vfs_open(MP_ARRAY_SIZE(open_args), &open_args[0], (mp_map_t *)&mp_const_empty_map);
+  mp_buffer_info_t bufinfo;
+  if (mp_get_buffer(file, &bufinfo, MP_BUFFER_READ) && bufinfo.len > 0 && bufinfo.len <= MAX_TEXT
+      && ((const uint8_t *) bufinfo.buf)[bufinfo.len - 1] == LF) {
+    view_mapped(filename, (const uint8_t *) bufinfo.buf, bufinfo.len);
+    mp_stream_close(file);
+    return mp_const_none;
+  }
+  mp_stream_close(file);
+  return edit_files(1, &filename_obj, 1);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(view_obj, view);
+
+#if MICROPY_MODULE_BUILTIN_INIT
+STATIC mp_obj_t
+editor_init()
+{
+  MP_STATE_VM(editor_buffer_obj) = mp_const_none;
+  for (size_t i = 0; i < MP_ARRAY_SIZE(MP_STATE_VM(editor_filters)); i ++) {
+    MP_STATE_VM(editor_filters)[i] = MP_OBJ_NULL;
+  }
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(editor_init_obj, editor_init);
+#endif /* MICROPY_MODULE_BUILTIN_INIT */
+
+/* the index of the filter registered as name, -1 without one */
+static int
+find_filter(const char *name, size_t len)
+{
+  for (size_t i = 0; i < MP_ARRAY_SIZE(MP_STATE_VM(editor_filters)); i ++) {
+    mp_obj_t entry = MP_STATE_VM(editor_filters)[i];
+    if (entry == MP_OBJ_NULL) {
+      continue;
+    }
+    size_t count, size;
+    mp_obj_t *items;
+    mp_obj_get_array(entry, &count, &items);
+    const char *str = mp_obj_str_get_data(items[0], &size);
+    if (size == len && memcmp(str, name, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* "C-k", "M-w", "C-x C-s" or a single character */
+static int
+parse_key(mp_obj_t key_obj)
+{
+  size_t len;
+  const char *str = get_string(key_obj, &len);
+  int prefix = 0, key = -1;
+  if (len > 4 && strncmp(str, "C-x ", 4) == 0) {
+    prefix = KEY_CX(0);
+    str += 4;
+    len -= 4;
+  }
+  if (len == 1) {
+    key = (uint8_t) str[0];
+  } else if (len == 3 && str[0] == 'C' && str[1] == '-') {
+    int ch = (str[2] >= 'a' && str[2] <= 'z') ? str[2] - 0x20 : str[2];
+    if (ch >= '@' && ch <= '_') {
+      key = CONTROL(ch);
+    }
+  } else if (len == 3 && str[0] == 'M' && str[1] == '-' && !prefix) {
+    key = KEY_META((uint8_t) str[2]);
+  }
+  if (key < 0 || (key >= 0200 && key < 0400) || (prefix && key >= 0200)) {
+    mp_raise_ValueError(MP_ERROR_TEXT("unknown key."));
+  }
+  return prefix + key;
+}
+
+STATIC mp_obj_t
+bind(mp_obj_t key_obj, mp_obj_t command_obj)
+{
+  int key = parse_key(key_obj);
+  int i;
+  for (i = 0; i < overlay_count; i ++) {
+    if (overlay[i].key == key) {
+      break;
+    }
+  }
+  if (command_obj == mp_const_none) {
+    /* back to the default binding */
+    if (i < overlay_count) {
+      overlay[i] = overlay[-- overlay_count];
+    }
+    return mp_const_none;
+  }
+  size_t len;
+  const char *name = get_string(command_obj, &len);
+  uint8_t command;
+  for (command = 0; command < CMD_COUNT; command ++) {
+    if (strlen(commands[command].name) == len && memcmp(commands[command].name, name, len) == 0) {
+      break;
+    }
+  }
+  int filter = (command == CMD_COUNT) ? find_filter(name, len) : -1;
+  if (filter >= 0) {
+    command = CMD_FILTER;
+  }
+  if (command == CMD_COUNT) {
+    mp_raise_ValueError(MP_ERROR_TEXT("unknown command."));
+  }
+  if (i == overlay_count) {
+    if (overlay_count == OVERLAY_SIZE) {
+      mp_raise_ValueError(MP_ERROR_TEXT("too many bindings."));
+    }
+    overlay_count ++;
+  }
+  overlay[i].key = key;
+  overlay[i].command = command;
+  overlay[i].filter = (filter >= 0) ? filter : NO_FILTER;
+  return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(bind_obj, bind);
+
+/* None removes the filter and the keys bound to it */
+STATIC mp_obj_t
+register_filter(mp_obj_t name_obj, mp_obj_t fn)
+{
+  size_t len;
+  const char *name = get_string(name_obj, &len);
+  int i = find_filter(name, len);
+  if (fn == mp_const_none) {
+    if (i < 0) {
+      return mp_const_none;
+    }
+    MP_STATE_VM(editor_filters)[i] = MP_OBJ_NULL;
+    /* the slot can be taken by another filter */
+    for (int j = overlay_count; j -- > 0; ) {
+      if (overlay[j].filter == i) {
+        overlay[j] = overlay[-- overlay_count];
+      }
+    }
+    return mp_const_none;
+  }
+  if (!mp_obj_is_callable(fn)) {
+    mp_raise_TypeError(MP_ERROR_TEXT("filter must be callable."));
+  }
+  for (size_t j = 0; i < 0 && j < MP_ARRAY_SIZE(MP_STATE_VM(editor_filters)); j ++) {
+    if (MP_STATE_VM(editor_filters)[j] == MP_OBJ_NULL) {
+      i = j;
+    }
+  }
+  if (i < 0) {
+    mp_raise_ValueError(MP_ERROR_TEXT("too many filters."));
+  }
+  mp_obj_t items[2] = { name_obj, fn };
+  MP_STATE_VM(editor_filters)[i] = mp_obj_new_tuple(2, items);
+  last_filter = i;
   return mp_const_none;
 }
-STATIC MP_DEFINE_CONST_FUN_OBJ_1(edit_obj, edit);
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(register_filter_obj, register_filter);
+
+STATIC mp_obj_t
+output_stats()
+{
+  uint32_t bytes, keys;
+  get_output_stats(&bytes, &keys);
+  mp_obj_t items[2] = { mp_obj_new_int_from_uint(bytes), mp_obj_new_int_from_uint(keys) };
+  return mp_obj_new_tuple(2, items);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(output_stats_obj, output_stats);
 
 STATIC const mp_rom_map_elem_t example_module_globals_table[] = {
   { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_editor) },
-  { MP_ROM_QSTR(MP_QSTR_set_buffer_size), MP_ROM_PTR(&set_buffer_size_obj) },
+#if MICROPY_MODULE_BUILTIN_INIT
+  { MP_ROM_QSTR(MP_QSTR___init__), MP_ROM_PTR(&editor_init_obj) },
+#endif /* MICROPY_MODULE_BUILTIN_INIT */
+  { MP_ROM_QSTR(MP_QSTR_set_autosave), MP_ROM_PTR(&set_autosave_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_buffer), MP_ROM_PTR(&set_buffer_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_compress), MP_ROM_PTR(&set_compress_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_highlight), MP_ROM_PTR(&set_highlight_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_line_numbers), MP_ROM_PTR(&set_line_numbers_obj) },
   { MP_ROM_QSTR(MP_QSTR_set_screen), MP_ROM_PTR(&set_screen_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_status), MP_ROM_PTR(&set_status_obj) },
   { MP_ROM_QSTR(MP_QSTR_set_tab_width), MP_ROM_PTR(&set_tab_width_obj) },
+  { MP_ROM_QSTR(MP_QSTR_set_wrap), MP_ROM_PTR(&set_wrap_obj) },
+  { MP_ROM_QSTR(MP_QSTR_bind), MP_ROM_PTR(&bind_obj) },
+  { MP_ROM_QSTR(MP_QSTR_register_filter), MP_ROM_PTR(&register_filter_obj) },
   { MP_ROM_QSTR(MP_QSTR_edit), MP_ROM_PTR(&edit_obj) },
+  { MP_ROM_QSTR(MP_QSTR_follow), MP_ROM_PTR(&follow_obj) },
+  { MP_ROM_QSTR(MP_QSTR_view), MP_ROM_PTR(&view_obj) },
+  { MP_ROM_QSTR(MP_QSTR_output_stats), MP_ROM_PTR(&output_stats_obj) },
 };
 STATIC MP_DEFINE_CONST_DICT(example_module_globals, example_module_globals_table);
 
@@ -357,3 +2998,8 @@ const mp_obj_module_t editor_module = {
 };
 
 MP_REGISTER_MODULE(MP_QSTR_editor, editor_module);
+MP_REGISTER_ROOT_POINTER(mp_obj_t editor_buffer_obj);
+MP_REGISTER_ROOT_POINTER(uint8_t *editor_buffer);
+MP_REGISTER_ROOT_POINTER(void *editor_lines);
+MP_REGISTER_ROOT_POINTER(mp_obj_t editor_autosave_file);
+MP_REGISTER_ROOT_POINTER(mp_obj_t editor_filters[4]);
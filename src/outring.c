@@ -0,0 +1,70 @@
+#include <string.h>
+#include "editor.h"
+#include "outring.h"
+
+#if OUTPUT_RING_SIZE > 0
+
+/*
+ * The output ring passes the bytes for the terminal from the editor to
+ * the thread writing them out. There is one writer and one reader: head
+ * is only moved by or_write() and tail only by or_consume(), each with a
+ * release store after the bytes it covers, so no lock is needed. The
+ * indexes run freely and are masked when used.
+ */
+
+#define MASK			(OUTPUT_RING_SIZE - 1)
+
+static char ring[OUTPUT_RING_SIZE];
+static uint32_t head, tail;
+
+void
+or_reset()
+{
+  head = tail = 0;
+}
+
+/* waits while the ring is full */
+void
+or_write(const char *str, size_t count)
+{
+  uint32_t h = head;
+  while (count) {
+	uint32_t room = OUTPUT_RING_SIZE - (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+	if (room == 0) {
+	  continue;
+	}
+	uint32_t n = OUTPUT_RING_SIZE - (h & MASK);
+	n = min(n, room);
+	n = min(n, count);
+	memcpy(&ring[h & MASK], str, n);
+	h += n;
+	__atomic_store_n(&head, h, __ATOMIC_RELEASE);
+	str += n;
+	count -= n;
+  }
+}
+
+/* the bytes that can be read in one piece */
+size_t
+or_peek(const char **str)
+{
+  uint32_t t = tail;
+  uint32_t n = __atomic_load_n(&head, __ATOMIC_ACQUIRE) - t;
+  uint32_t end = OUTPUT_RING_SIZE - (t & MASK);
+  *str = &ring[t & MASK];
+  return min(n, end);
+}
+
+void
+or_consume(size_t count)
+{
+  __atomic_store_n(&tail, tail + count, __ATOMIC_RELEASE);
+}
+
+int
+or_empty()
+{
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE) == __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+}
+
+#endif /* OUTPUT_RING_SIZE > 0 */
@@ -0,0 +1,31 @@
+#ifndef __OUTRING_H
+#define __OUTRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MODEDITOR_OUTPUT_RING_SIZE
+#define MODEDITOR_OUTPUT_RING_SIZE	0
+#endif
+
+#define OUTPUT_RING_SIZE	MODEDITOR_OUTPUT_RING_SIZE
+
+#if OUTPUT_RING_SIZE & (OUTPUT_RING_SIZE - 1)
+#error "MODEDITOR_OUTPUT_RING_SIZE must be a power of 2"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void or_reset();
+  void or_write(const char *str, size_t count);
+  size_t or_peek(const char **str);
+  void or_consume(size_t count);
+  int or_empty();
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __OUTRING_H */
@@ -1,19 +1,38 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "ucurses.h"
 
 void (*putnstr_func)(const char *, size_t) = NULL;
 int (*getchar_func)(void) = NULL;
+int (*kbhit_func)(int) = NULL;
 
 static void put_nstr(const char *str, size_t count);
 static void put_num(uint16_t num);
 static void put_csi();
+static void put_private(const char *mode, char set);
+static void close_frame();
+static int read_reports(int *rows, int *cols);
+
+static int cur_attr = A_NORMAL;
+static int scrreg_set = 0;
+static uint32_t output_bytes = 0, input_keys = 0;
+static int sync_update = 0;
+
+/* what is put waits here until refresh(), or until it is full */
+static char frame_buffer[FRAME_BUFFER_SIZE];
+static size_t frame_length = 0;
+
+/* a frame is only opened by the first output after begin_update() */
+static enum {FR_NONE = 0, FR_PENDING, FR_OPEN} frame = FR_NONE;
 
 enum {GM_NONE = 0, GM_ESC, GM_CSI, GM_CURSOR} getch_mode = GM_NONE;
 
+/* what is still buffered goes to the function it was put for */
 void
 set_putnstr_func(void (*_putnstr)(const char *, size_t))
 {
+  refresh();
   putnstr_func = _putnstr;
 }
 
@@ -23,14 +42,51 @@ set_getchar_func(int (*_getchar)(void))
   getchar_func = _getchar;
 }
 
+void
+set_kbhit_func(int (*_kbhit)(int))
+{
+  kbhit_func = _kbhit;
+}
+
+/*
+ * The mode of synchronized output is asked for (DECRQM) once, however
+ * the screen size was set. The cursor position asked for after it is
+ * answered by any terminal, so a report that does not come costs no wait.
+ */
 void
 initscr()
 {
+  int rows, cols;
+
+  output_bytes = input_keys = 0;
+  frame = FR_NONE;
+  sync_update = 0;
+  if (getchar_func != NULL && kbhit_func != NULL) {
+	put_csi();
+	put_nstr("?2026$p", 7);
+	put_csi();
+	put_nstr("6n", 2);
+	read_reports(&rows, &cols);
+  }
+  put_csi();
+  put_nstr("0m", 2);
+  cur_attr = A_NORMAL;
 }
 
 void
 endwin()
 {
+  if (frame == FR_OPEN) {
+	close_frame();
+  }
+  frame = FR_NONE;
+  attrset(A_NORMAL);
+  if (scrreg_set) {
+	put_csi();
+	put_nstr("r", 1);
+	scrreg_set = 0;
+  }
+  refresh();
 }
 
 void
@@ -43,6 +99,30 @@ move(int y, int x)
   put_nstr("H", 1);
 }
 
+/*
+ * The output up to end_update() is one frame: the cursor is hidden while
+ * it moves over the rows and, on a terminal that has the synchronized
+ * output mode, the screen changes all at once.
+ */
+void
+begin_update()
+{
+  frame = FR_PENDING;
+}
+
+/* the cursor is placed and shown once at the end of the frame */
+void
+end_update(int y, int x)
+{
+  int opened = (frame == FR_OPEN);
+  frame = FR_NONE;
+  move(y, x);
+  if (opened) {
+	close_frame();
+  }
+  refresh();
+}
+
 void
 save_cursor_position()
 {
@@ -95,6 +175,47 @@ clrtobot()
   put_nstr("0J", 2);
 }
 
+void
+attrset(int attr)
+{
+  if (attr == cur_attr) {
+	return;
+  }
+  cur_attr = attr;
+  put_csi();
+  put_nstr("0", 1);
+  if (attr & A_BOLD) {
+	put_nstr(";1", 2);
+  }
+  if (attr & A_REVERSE) {
+	put_nstr(";7", 2);
+  }
+  if (attr & A_COLOR) {
+	char tmp[3] = {';', '3', '0' + (attr & 7)};
+	put_nstr(tmp, 3);
+  }
+  put_nstr("m", 1);
+}
+
+void
+setscrreg(int top, int bot)
+{
+  put_csi();
+  put_num(top + 1);
+  put_nstr(";", 1);
+  put_num(bot + 1);
+  put_nstr("r", 1);
+  scrreg_set = 1;
+}
+
+void
+scrl(int n)
+{
+  put_csi();
+  put_num(n);
+  put_nstr("S", 1);
+}
+
 int
 getch()
 {
@@ -103,6 +224,8 @@ getch()
   if (getchar_func == NULL) {
 	return 0;
   }
+  refresh();
+  input_keys ++;
   getch_mode = GM_NONE;
   while (1) {
 	int ch = (*getchar_func)();
@@ -127,6 +250,8 @@ getch()
 		return KEY_SHOME;
 	  } else if (ch == '>') {
 		return KEY_SEND;
+	  } else if ((ch > ' ' && ch <= DEL) || ch == '\b') {
+		return KEY_META(ch);
 	  } else {
 		return KEY_MAX;
 	  }
@@ -174,14 +299,115 @@ getch()
   return KEY_MAX;
 }
 
+/* sends what is buffered */
+void
+refresh()
+{
+  if (frame_length > 0 && putnstr_func != NULL) {
+	(*putnstr_func)(frame_buffer, frame_length);
+  }
+  frame_length = 0;
+}
+
+/* bytes sent and keys read since initscr() */
+void
+get_output_stats(uint32_t *bytes, uint32_t *keys)
+{
+  *bytes = output_bytes;
+  *keys = input_keys;
+}
+
+int
+get_screen_size(int *rows, int *cols)
+{
+  if (getchar_func == NULL || kbhit_func == NULL) {
+	return 0;
+  }
+  save_cursor_position();
+  move(998, 998);
+  put_csi();
+  put_nstr("6n", 2);
+  int found = read_reports(rows, cols);
+  restore_cursor_position();
+  refresh();
+  return found;
+}
+
 /* Helper functions */
+
+/*
+ * Reads the reports up to the cursor position, which gives the rows and
+ * columns. A DECRQM report of the synchronized output mode on the way
+ * tells if the terminal has it.
+ */
+static int
+read_reports(int *rows, int *cols)
+{
+  int param1 = 0, param2 = 0;
+  int state = 0;
+
+  refresh();
+  while (state != 4 && (*kbhit_func)(PROBE_TIMEOUT)) {
+	int ch = (*getchar_func)();
+	if (state == 0) {
+	  state = (ch == ESC) ? 1 : 0;
+	} else if (state == 1) {
+	  state = (ch == '[') ? 2 : 0;
+	} else if (state == 2 && ch == '?' && param1 == 0) {
+	  state = 5;
+	} else if (ch >= '0' && ch <= '9' && state != 7) {
+	  if (state == 2 || state == 5) {
+		param1 = (param1 * 10) + ch - '0';
+	  } else {
+		param2 = (param2 * 10) + ch - '0';
+	  }
+	} else if ((state == 2 || state == 5) && ch == ';') {
+	  state ++;
+	} else if (state == 3 && ch == 'R') {
+	  state = 4;
+	} else if (state == 6 && ch == '$') {
+	  state = 7;
+	} else if (state == 7 && ch == 'y') {
+	  /* 1 or 2: the mode is there, set or reset */
+	  sync_update = (param1 == 2026 && (param2 == 1 || param2 == 2));
+	  state = 0;
+	  param1 = param2 = 0;
+	} else {
+	  state = (ch == ESC) ? 1 : 0;
+	  param1 = param2 = 0;
+	}
+  }
+  if (state < 4 || param1 == 0 || param2 == 0) {
+	return 0;
+  }
+  *rows = param1;
+  *cols = param2;
+  return 1;
+}
+
 static void
 put_nstr(const char *str, size_t count)
 {
   if (putnstr_func == NULL) {
 	return;
   }
-  (*putnstr_func)(str, count);
+  if (frame == FR_PENDING) {
+	frame = FR_OPEN;
+	if (sync_update) {
+	  put_private("2026", 'h');
+	}
+	put_private("25", 'l');
+  }
+  output_bytes += count;
+  if (frame_length + count > FRAME_BUFFER_SIZE) {
+	refresh();
+  }
+  if (count > FRAME_BUFFER_SIZE) {
+	(*putnstr_func)(str, count);
+	return;
+  }
+  memcpy(frame_buffer + frame_length, str, count);
+  frame_length += count;
 }
 
 static void
@@ -206,6 +432,24 @@ put_csi()
   put_nstr(tmp, 2);
 }
 
+static void
+close_frame()
+{
+  put_private("25", 'h');
+  if (sync_update) {
+	put_private("2026", 'l');
+  }
+}
+
+static void
+put_private(const char *mode, char set)
+{
+  put_csi();
+  put_nstr("?", 1);
+  addstr(mode);
+  put_nstr(&set, 1);
+}
+
 //#define MAIN
 #ifdef MAIN
 #include <stdio.h>
@@ -3,6 +3,7 @@
 
 #define NUL '\0'
 #define ESC '\033'
+#define DEL '\177'
 
 #define KEY_ESC         033
 #define KEY_DOWN        0402
@@ -21,6 +22,29 @@
 #define KEY_SEND        0602
 #define KEY_SHOME       0607
 #define KEY_MAX         0777
+#define KEY_META(c)     (01000+(c))
+
+#define PROBE_TIMEOUT   100
+
+#ifndef MODEDITOR_FRAME_BUFFER_SIZE
+#define MODEDITOR_FRAME_BUFFER_SIZE 256
+#endif
+#define FRAME_BUFFER_SIZE MODEDITOR_FRAME_BUFFER_SIZE
+
+#define COLOR_BLACK     0
+#define COLOR_RED       1
+#define COLOR_GREEN     2
+#define COLOR_YELLOW    3
+#define COLOR_BLUE      4
+#define COLOR_MAGENTA   5
+#define COLOR_CYAN      6
+#define COLOR_WHITE     7
+
+#define A_NORMAL        0x000
+#define A_COLOR         0x00F
+#define A_BOLD          0x100
+#define A_REVERSE       0x200
+#define FG(c)           (0x008|(c))
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,6 +52,7 @@ extern "C" {
 
   void set_putnstr_func(void (*)(const char *, size_t));
   void set_getchar_func(int (*)(void));
+  void set_kbhit_func(int (*)(int));
   void initscr();
   void endwin();
   void move(int y, int x);
@@ -36,10 +61,18 @@ extern "C" {
   void clear();
   void clrtoeol();
   void clrtobot();
+  void attrset(int attr);
+  void setscrreg(int top, int bot);
+  void scrl(int n);
   int getch();
+  void refresh();
 
+  void begin_update();
+  void end_update(int y, int x);
   void save_cursor_position();
   void restore_cursor_position();
+  int get_screen_size(int *rows, int *cols);
+  void get_output_stats(uint32_t *bytes, uint32_t *keys);
 
 #ifdef __cplusplus
 };
@@ -0,0 +1,10 @@
+#ifndef __STUB_VFS_H
+#define __STUB_VFS_H
+
+#include "py/runtime.h"
+
+mp_obj_t mp_vfs_open(size_t n_args, const mp_obj_t *args, mp_map_t *kw_args);
+mp_obj_t mp_vfs_stat(mp_obj_t path);
+mp_obj_t mp_vfs_remove(mp_obj_t path);
+
+#endif /* __STUB_VFS_H */
@@ -0,0 +1,16 @@
+#ifndef __HOST_H
+#define __HOST_H
+
+#include <stddef.h>
+
+/*
+ * The terminal of the stub HAL: what the editor writes goes to
+ * host_write() and the keys come from host_read(), which raises when
+ * the script has run out. host_ready() tells if a key is waiting.
+ */
+
+void host_write(const char *str, size_t len);
+int host_read(void);
+int host_ready(void);
+
+#endif /* __HOST_H */
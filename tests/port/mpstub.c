@@ -0,0 +1,375 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "py/runtime.h"
+#include "py/mphal.h"
+#include "py/stream.h"
+#include "extmod/vfs.h"
+#include "host.h"
+
+stub_obj_t stub_none = { .type = OBJ_NONE };
+stub_obj_t stub_true = { .type = OBJ_BOOL, .value = 1 };
+stub_obj_t stub_false = { .type = OBJ_BOOL, .value = 0 };
+const mp_map_t mp_const_empty_map = {0, NULL};
+const mp_obj_base_t mp_type_module, mp_type_RuntimeError;
+nlr_buf_t *stub_nlr_top = NULL;
+const char *stub_error = NULL;
+int mp_interrupt_char = 3;
+
+static mp_uint_t ticks = 0;
+
+/* Objects */
+
+static stub_obj_t *
+new_obj(int type)
+{
+  stub_obj_t *obj = calloc(1, sizeof *obj);
+  if (obj == NULL) {
+    abort();
+  }
+  obj->type = type;
+  return obj;
+}
+
+mp_obj_t
+mp_obj_new_str(const char *str, size_t len)
+{
+  stub_obj_t *obj = new_obj(OBJ_STR);
+  obj->data = malloc(len + 1);
+  memcpy(obj->data, str, len);
+  obj->data[len] = '\0';
+  obj->len = len;
+  return obj;
+}
+
+mp_obj_t
+mp_obj_new_bytes(const byte *data, size_t len)
+{
+  stub_obj_t *obj = mp_obj_new_str((const char *) data, len);
+  obj->type = OBJ_BYTES;
+  return obj;
+}
+
+mp_obj_t
+mp_obj_new_int(mp_int_t value)
+{
+  stub_obj_t *obj = new_obj(OBJ_INT);
+  obj->value = value;
+  return obj;
+}
+
+mp_obj_t
+mp_obj_new_int_from_uint(mp_uint_t value)
+{
+  return mp_obj_new_int((mp_int_t) value);
+}
+
+mp_obj_t
+mp_obj_new_tuple(size_t len, const mp_obj_t *items)
+{
+  stub_obj_t *obj = new_obj(OBJ_TUPLE);
+  obj->items = calloc(len + 1, sizeof(stub_obj_t *));
+  if (items != NULL) {
+    memcpy(obj->items, items, len * sizeof(mp_obj_t));
+  }
+  obj->len = len;
+  return obj;
+}
+
+mp_int_t
+mp_obj_get_int(mp_obj_t obj)
+{
+  stub_obj_t *o = obj;
+  if (o->type != OBJ_INT && o->type != OBJ_BOOL) {
+    mp_raise_TypeError("can't convert to int");
+  }
+  return o->value;
+}
+
+bool
+mp_obj_is_true(mp_obj_t obj)
+{
+  stub_obj_t *o = obj;
+  if (o->type == OBJ_NONE) {
+    return false;
+  }
+  if (o->type == OBJ_INT || o->type == OBJ_BOOL) {
+    return o->value != 0;
+  }
+  return true;
+}
+
+bool
+mp_obj_is_str(mp_obj_t obj)
+{
+  return ((stub_obj_t *) obj)->type == OBJ_STR;
+}
+
+bool
+mp_obj_is_callable(mp_obj_t obj)
+{
+  return false;
+}
+
+const char *
+mp_obj_str_get_data(mp_obj_t obj, size_t *len)
+{
+  stub_obj_t *o = obj;
+  if (o->type != OBJ_STR && o->type != OBJ_BYTES) {
+    mp_raise_TypeError("can't convert to str");
+  }
+  *len = o->len;
+  return (const char *) o->data;
+}
+
+void
+mp_obj_get_array(mp_obj_t obj, size_t *len, mp_obj_t **items)
+{
+  stub_obj_t *o = obj;
+  *len = o->len;
+  *items = (mp_obj_t *) o->items;
+}
+
+mp_obj_t
+mp_call_function_1(mp_obj_t fun, mp_obj_t arg)
+{
+  mp_raise_TypeError("object isn't callable");
+}
+
+bool
+mp_get_buffer(mp_obj_t obj, mp_buffer_info_t *bufinfo, int flags)
+{
+  stub_obj_t *o = obj;
+  if (o->type == OBJ_BYTEARRAY || (o->type == OBJ_BYTES && !(flags & MP_BUFFER_WRITE))) {
+    bufinfo->buf = o->data;
+    bufinfo->len = o->len;
+    bufinfo->typecode = 'B';
+    return true;
+  }
+  return false;
+}
+
+void
+mp_get_buffer_raise(mp_obj_t obj, mp_buffer_info_t *bufinfo, int flags)
+{
+  if (!mp_get_buffer(obj, bufinfo, flags)) {
+    mp_raise_TypeError("object with buffer protocol required");
+  }
+}
+
+/* Exceptions */
+
+void
+nlr_pop(void)
+{
+  stub_nlr_top = stub_nlr_top->prev;
+}
+
+void
+nlr_jump(void *val)
+{
+  nlr_buf_t *top = stub_nlr_top;
+  if (top == NULL) {
+    fprintf(stderr, "uncaught exception: %s\n", stub_error);
+    abort();
+  }
+  stub_nlr_top = top->prev;
+  top->ret_val = val;
+  longjmp(top->jmpbuf, 1);
+}
+
+void
+mp_raise_msg(const mp_obj_base_t *type, const char *msg)
+{
+  stub_error = msg;
+  nlr_jump(NULL);
+}
+
+void
+mp_raise_ValueError(const char *msg)
+{
+  mp_raise_msg(NULL, msg);
+}
+
+void
+mp_raise_TypeError(const char *msg)
+{
+  mp_raise_msg(NULL, msg);
+}
+
+void
+mp_raise_OSError(int errcode)
+{
+  mp_raise_msg(NULL, strerror(errcode));
+}
+
+/* Heap */
+
+void *
+m_malloc(size_t size)
+{
+  void *ptr = calloc(1, size);
+  if (ptr == NULL) {
+    mp_raise_msg(NULL, "memory allocation failed");
+  }
+  return ptr;
+}
+
+void *
+m_realloc_maybe(void *ptr, size_t size, bool allow_move)
+{
+  return realloc(ptr, size);
+}
+
+void
+m_free(void *ptr)
+{
+  free(ptr);
+}
+
+/* Terminal: the clock only moves while the editor waits */
+
+void
+mp_hal_stdio_mode_raw(void)
+{
+}
+
+void
+mp_hal_stdio_mode_orig(void)
+{
+}
+
+void
+mp_hal_stdout_tx_strn(const char *str, size_t len)
+{
+  host_write(str, len);
+}
+
+int
+mp_hal_stdin_rx_chr(void)
+{
+  return host_read();
+}
+
+uintptr_t
+mp_hal_stdio_poll(uintptr_t poll_flags)
+{
+  return host_ready() ? (poll_flags & MP_STREAM_POLL_RD) : 0;
+}
+
+mp_uint_t
+mp_hal_ticks_ms(void)
+{
+  return ticks;
+}
+
+void
+mp_hal_delay_ms(mp_uint_t ms)
+{
+  ticks += ms;
+}
+
+void
+mp_hal_delay_us(mp_uint_t us)
+{
+  ticks += us / 1000;
+}
+
+/* Files */
+
+static mp_uint_t
+file_ioctl(mp_obj_t obj, mp_uint_t request, uintptr_t arg, int *errcode)
+{
+  FILE *fp = ((stub_obj_t *) obj)->file;
+  if (request == MP_STREAM_SEEK) {
+    struct mp_stream_seek_t *seek_s = (struct mp_stream_seek_t *) arg;
+    if (fseek(fp, seek_s->offset, seek_s->whence) != 0) {
+      *errcode = errno;
+      return MP_STREAM_ERROR;
+    }
+    seek_s->offset = ftell(fp);
+    return 0;
+  }
+  if (request == MP_STREAM_FLUSH) {
+    fflush(fp);
+    return 0;
+  }
+  *errcode = EINVAL;
+  return MP_STREAM_ERROR;
+}
+
+static const mp_stream_p_t file_stream = { NULL, NULL, file_ioctl, 0 };
+
+const mp_stream_p_t *
+mp_get_stream(mp_obj_t obj)
+{
+  return &file_stream;
+}
+
+mp_uint_t
+mp_stream_rw(mp_obj_t stream, void *buf, mp_uint_t size, int *errcode, byte flags)
+{
+  FILE *fp = ((stub_obj_t *) stream)->file;
+  *errcode = 0;
+  if (flags & MP_STREAM_RW_WRITE) {
+    return fwrite(buf, 1, size, fp);
+  }
+  clearerr(fp);
+  return fread(buf, 1, size, fp);
+}
+
+mp_obj_t
+mp_stream_close(mp_obj_t stream)
+{
+  stub_obj_t *o = stream;
+  if (o->file != NULL) {
+    fclose(o->file);
+    o->file = NULL;
+  }
+  return mp_const_none;
+}
+
+mp_obj_t
+mp_vfs_open(size_t n_args, const mp_obj_t *args, mp_map_t *kw_args)
+{
+  size_t len;
+  const char *name = mp_obj_str_get_data(args[0], &len);
+  const char *mode = (n_args > 1) ? mp_obj_str_get_data(args[1], &len) : "r";
+  FILE *fp = fopen(name, mode);
+  if (fp == NULL) {
+    mp_raise_OSError(errno);
+  }
+  stub_obj_t *obj = new_obj(OBJ_FILE);
+  obj->file = fp;
+  return obj;
+}
+
+mp_obj_t
+mp_vfs_stat(mp_obj_t path)
+{
+  size_t len;
+  struct stat st;
+  if (stat(mp_obj_str_get_data(path, &len), &st) != 0) {
+    mp_raise_OSError(errno);
+  }
+  mp_obj_t items[10];
+  for (int i = 0; i < 10; i ++) {
+    items[i] = mp_obj_new_int(0);
+  }
+  items[6] = mp_obj_new_int(st.st_size);
+  items[8] = mp_obj_new_int(st.st_mtime);
+  return mp_obj_new_tuple(10, items);
+}
+
+mp_obj_t
+mp_vfs_remove(mp_obj_t path)
+{
+  size_t len;
+  if (unlink(mp_obj_str_get_data(path, &len)) != 0) {
+    mp_raise_OSError(errno);
+  }
+  return mp_const_none;
+}
@@ -0,0 +1,15 @@
+#ifndef __STUB_MPHAL_H
+#define __STUB_MPHAL_H
+
+#include "py/runtime.h"
+
+void mp_hal_stdio_mode_raw(void);
+void mp_hal_stdio_mode_orig(void);
+void mp_hal_stdout_tx_strn(const char *str, size_t len);
+int mp_hal_stdin_rx_chr(void);
+uintptr_t mp_hal_stdio_poll(uintptr_t poll_flags);
+mp_uint_t mp_hal_ticks_ms(void);
+void mp_hal_delay_ms(mp_uint_t ms);
+void mp_hal_delay_us(mp_uint_t us);
+
+#endif /* __STUB_MPHAL_H */
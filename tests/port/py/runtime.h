@@ -0,0 +1,136 @@
+#ifndef __STUB_RUNTIME_H
+#define __STUB_RUNTIME_H
+
+/*
+ * Just enough of the MicroPython runtime for modeditor.c to be built and
+ * run on the host. Objects are plain structs that are never freed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+#define STATIC static
+#define MP_ERROR_TEXT(x) (x)
+#define MICROPY_MALLOC_USES_ALLOCATED_SIZE (0)
+#define MICROPY_MODULE_BUILTIN_INIT (1)
+#define MICROPY_PY_THREAD (0)
+
+typedef void *mp_obj_t;
+typedef const char *qstr;
+typedef intptr_t mp_int_t;
+typedef uintptr_t mp_uint_t;
+typedef long mp_off_t;
+typedef unsigned char byte;
+
+#include "genhdr/qstrdefs.h"
+#include "genhdr/root_pointers.h"
+
+enum {
+  OBJ_NONE, OBJ_BOOL, OBJ_INT, OBJ_STR, OBJ_BYTES, OBJ_BYTEARRAY, OBJ_TUPLE, OBJ_FILE
+};
+
+typedef struct _stub_obj_t {
+  int type;
+  mp_int_t value;
+  size_t len;
+  uint8_t *data;
+  void *file;
+  struct _stub_obj_t **items;
+} stub_obj_t;
+
+typedef struct {
+  int nargs_min, nargs_max;
+  void *fun;
+} mp_obj_fun_builtin_t;
+
+#define MP_FUN_VAR 100
+#define MP_DEFINE_CONST_FUN_OBJ_0(name, f) const mp_obj_fun_builtin_t name = {0, 0, (void *) f}
+#define MP_DEFINE_CONST_FUN_OBJ_1(name, f) const mp_obj_fun_builtin_t name = {1, 1, (void *) f}
+#define MP_DEFINE_CONST_FUN_OBJ_2(name, f) const mp_obj_fun_builtin_t name = {2, 2, (void *) f}
+#define MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(name, a, b, f) \
+  const mp_obj_fun_builtin_t name = {a, MP_FUN_VAR + b, (void *) f}
+
+typedef struct {
+  mp_obj_t key, value;
+} mp_rom_map_elem_t;
+typedef struct {
+  size_t used;
+  const mp_rom_map_elem_t *table;
+} mp_map_t;
+typedef struct {
+  mp_map_t map;
+} mp_obj_dict_t;
+typedef struct {
+  const void *type;
+} mp_obj_base_t;
+typedef struct {
+  mp_obj_base_t base;
+  mp_obj_dict_t *globals;
+} mp_obj_module_t;
+
+#define MP_ROM_QSTR(q) ((mp_obj_t) (q))
+#define MP_ROM_PTR(p) ((mp_obj_t) (p))
+#define MP_DEFINE_CONST_DICT(name, table) \
+  const mp_obj_dict_t name = {{sizeof(table) / sizeof(table[0]), table}}
+#define MP_REGISTER_MODULE(name, module)
+#define MP_REGISTER_ROOT_POINTER(decl) decl
+#define MP_STATE_VM(x) x
+#define MP_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MP_OBJ_NEW_QSTR(q) mp_obj_new_str((q), strlen(q))
+#define MP_OBJ_NULL ((mp_obj_t) 0)
+
+extern stub_obj_t stub_none, stub_true, stub_false;
+extern const mp_map_t mp_const_empty_map;
+extern const mp_obj_base_t mp_type_module, mp_type_RuntimeError;
+#define mp_const_none ((mp_obj_t) &stub_none)
+#define mp_const_true ((mp_obj_t) &stub_true)
+#define mp_const_false ((mp_obj_t) &stub_false)
+
+mp_obj_t mp_obj_new_str(const char *str, size_t len);
+mp_obj_t mp_obj_new_bytes(const byte *data, size_t len);
+mp_obj_t mp_obj_new_int(mp_int_t value);
+mp_obj_t mp_obj_new_int_from_uint(mp_uint_t value);
+mp_obj_t mp_obj_new_tuple(size_t len, const mp_obj_t *items);
+mp_int_t mp_obj_get_int(mp_obj_t obj);
+bool mp_obj_is_true(mp_obj_t obj);
+bool mp_obj_is_str(mp_obj_t obj);
+bool mp_obj_is_callable(mp_obj_t obj);
+const char *mp_obj_str_get_data(mp_obj_t obj, size_t *len);
+void mp_obj_get_array(mp_obj_t obj, size_t *len, mp_obj_t **items);
+mp_obj_t mp_call_function_1(mp_obj_t fun, mp_obj_t arg);
+
+#define MP_BUFFER_READ 1
+#define MP_BUFFER_WRITE 2
+typedef struct {
+  void *buf;
+  size_t len;
+  int typecode;
+} mp_buffer_info_t;
+bool mp_get_buffer(mp_obj_t obj, mp_buffer_info_t *bufinfo, int flags);
+void mp_get_buffer_raise(mp_obj_t obj, mp_buffer_info_t *bufinfo, int flags);
+
+typedef struct _nlr_buf_t {
+  struct _nlr_buf_t *prev;
+  jmp_buf jmpbuf;
+  void *ret_val;
+} nlr_buf_t;
+extern nlr_buf_t *stub_nlr_top;
+#define nlr_push(buf) ((buf)->prev = stub_nlr_top, stub_nlr_top = (buf), setjmp((buf)->jmpbuf))
+void nlr_pop(void);
+void nlr_jump(void *val) __attribute__((noreturn));
+void mp_raise_ValueError(const char *msg) __attribute__((noreturn));
+void mp_raise_TypeError(const char *msg) __attribute__((noreturn));
+void mp_raise_OSError(int errcode) __attribute__((noreturn));
+void mp_raise_msg(const mp_obj_base_t *type, const char *msg) __attribute__((noreturn));
+/* the message of the last exception */
+extern const char *stub_error;
+
+void *m_malloc(size_t size);
+void *m_realloc_maybe(void *ptr, size_t size, bool allow_move);
+void m_free(void *ptr);
+#define m_new(type, num) ((type *) m_malloc(sizeof(type) * (num)))
+#define m_del(type, ptr, num) m_free(ptr)
+
+#endif /* __STUB_RUNTIME_H */
@@ -0,0 +1,31 @@
+#ifndef __STUB_STREAM_H
+#define __STUB_STREAM_H
+
+#include "py/runtime.h"
+
+#define MP_STREAM_RW_READ (0)
+#define MP_STREAM_RW_WRITE (2)
+#define MP_STREAM_RW_ONCE (1)
+#define MP_STREAM_FLUSH (1)
+#define MP_STREAM_SEEK (2)
+#define MP_STREAM_POLL_RD (0x0001)
+#define MP_STREAM_ERROR ((mp_uint_t) -1)
+#define MP_SEEK_SET (0)
+
+struct mp_stream_seek_t {
+  mp_off_t offset;
+  int whence;
+};
+
+typedef struct {
+  mp_uint_t (*read)(mp_obj_t obj, void *buf, mp_uint_t size, int *errcode);
+  mp_uint_t (*write)(mp_obj_t obj, const void *buf, mp_uint_t size, int *errcode);
+  mp_uint_t (*ioctl)(mp_obj_t obj, mp_uint_t request, uintptr_t arg, int *errcode);
+  mp_uint_t is_text;
+} mp_stream_p_t;
+
+const mp_stream_p_t *mp_get_stream(mp_obj_t obj);
+mp_uint_t mp_stream_rw(mp_obj_t stream, void *buf, mp_uint_t size, int *errcode, byte flags);
+mp_obj_t mp_stream_close(mp_obj_t stream);
+
+#endif /* __STUB_STREAM_H */
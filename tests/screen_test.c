@@ -0,0 +1,369 @@
+/*
+ * Replays key scripts through the editor on the host. What ucurses sends
+ * goes into a VT100 model; whenever a key is read, the rows of the
+ * window on the model must show the text of the buffer. The bytes sent
+ * in each scenario are checked against the budgets file.
+ *
+ *   screen_test budgets.txt       run the scenarios
+ *   screen_test -u budgets.txt    write the bytes sent as the new budgets
+ *   screen_test -v budgets.txt    show the screen at the end of each one
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "py/runtime.h"
+#include "host.h"
+#include "editor.h"
+#include "vt100.h"
+
+#define TEXT_FILE       "screen_test.py"
+#define OTHER_FILE      "screen_test2.py"
+#define MAX_SCENARIOS   32
+
+/* options of a scenario */
+#define WRAP            0x01
+#define HIGHLIGHT       0x02
+#define LINE_NUMBERS    0x04
+#define STATUS          0x08
+/* the size is asked for */
+#define DETECT          0x10
+/* the text is also opened as a second file */
+#define TWO_FILES       0x20
+/* the terminal has synchronized output, which each frame must use */
+#define SYNC            0x40
+
+typedef struct {
+  const char *name;
+  const char *keys;
+  int rows, cols;
+  int options;
+} scenario_t;
+
+extern const mp_obj_module_t editor_module;
+
+static const char text[] =
+  "import time\n"
+  "from machine import Pin\n"
+  "\n"
+  "# blink the LED on the board and count the blinks in a long comment line\n"
+  "led = Pin(25, Pin.OUT)\n"
+  "\n"
+  "def blink(times, delay=0.5):\n"
+  "\tfor i in range(times):\n"
+  "\t\tled.toggle()\n"
+  "\t\ttime.sleep(delay)\n"
+  "\treturn times\n"
+  "\n"
+  "class Counter:\n"
+  "    def __init__(self):\n"
+  "        self.count = 0\n"
+  "\n"
+  "    def add(self, n=1):\n"
+  "        self.count += n\n"
+  "        return self.count\n"
+  "\n"
+  "counter = Counter()\n"
+  "while True:\n"
+  "    counter.add(blink(3))\n"
+  "    print('blinked', counter.count, \"times\")\n"
+  "    time.sleep(1)\n"
+  "\n"
+  "# end\n";
+
+static const scenario_t scenarios[] = {
+  { "open", "\x18\x03", 10, 40, 0 },
+  { "type", "hello world\r\x18\x03", 10, 40, 0 },
+  { "next-line", "\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x0e\x18\x03", 10, 40, 0 },
+  { "page", "\x16\x16\x1bv\x1b>\x1b<\x18\x03", 10, 40, 0 },
+  { "long-line", "\x0e\x0e\x0e\x05x\x01\x18\x03", 10, 40, 0 },
+  { "kill-yank", "\x0e\x0b\x0b\x0b\x0b\x19\x19\x18\x03", 10, 40, 0 },
+  { "newline", "\x0e\x0e\x0e\x0e\x05\r\r\x08\x08\x18\x03", 10, 40, 0 },
+  { "macro", "\x18(ab\x0e\x01\x18)\x15" "5\x18" "e\x18\x03", 10, 40, 0 },
+  { "split", "\x18" "2\x18o\x0e\x0ezz\x18o\x16\x18" "1\x18\x03", 12, 40, TWO_FILES },
+  { "wrap", "\x0e\x0e\x0e\x05\x02\x02x\x0e\x0e\x18\x03", 10, 30, WRAP },
+  { "highlight", "\x0e\x0e\x0e\x0e\x0e\x0e\x0e'\x0e\x0e\x08\x16\x18\x03", 10, 40, HIGHLIGHT },
+  { "line-numbers", "\x0e\x0e\r\x16\x1bv\x18\x03", 10, 40, LINE_NUMBERS },
+  { "status", "\x0e\x06\x06y\x08\x0e\x18\x03", 10, 40, STATUS },
+  { "detect", "\x0e\x0ex\x16\x18\x03", 12, 50, DETECT | SYNC },
+  { "sync", "\x0e\x0ex\x16\x18\x03", 10, 40, SYNC },
+};
+
+static vt_t vt;
+static const char *keys;
+static size_t key_pos, key_length;
+static unsigned long sent;
+static const scenario_t *current;
+static char failure[256];
+
+static struct {
+  char name[32];
+  unsigned long bytes;
+} budgets[MAX_SCENARIOS];
+static int budget_count = 0;
+
+static void
+fail(const char *message)
+{
+  if (failure[0] == '\0') {
+    snprintf(failure, sizeof failure, "%s", message);
+  }
+}
+
+/* what drawline() shows of the row from column left */
+static void
+expected_row(row_t y, int left, char *row)
+{
+  int width = vt.cols - left;
+  memset(row, ' ', width);
+  row[width] = '\0';
+  if (ed->lines[y] == NOLINE) {
+    return;
+  }
+  const uint8_t *src = &ed->text[ed->lines[y]];
+  uint32_t right = (uint32_t) ed->leftcol + ed->columns;
+  uint32_t pos = 0;
+  while (pos < right && *src != NUL && *src != LF) {
+    uint8_t len = get_charlen(src);
+    col_t step = get_charwidth(src, pos);
+    if (wrapmode && pos > 0 && pos + step >= ed->columns) {
+      row[width - 1] = '\\';
+      return;
+    }
+    if (*src != TAB && pos >= ed->leftcol) {
+      row[pos - ed->leftcol] = (*src < 0x80 || len > 1) ? *src : '?';
+    }
+    src += len;
+    pos += step;
+  }
+}
+
+/* the window is found from where the cursor is left */
+static void
+check_screen()
+{
+  char message[256], row[VT_MAX_COLS + 1];
+  if (vt.y >= current->rows) {
+    /* a prompt on the message line */
+    return;
+  }
+  if (!vt.cursor_visible || vt.sync) {
+    fail("the cursor is hidden while a key is read");
+    return;
+  }
+  int top = vt.y - ed->cury;
+  int left = vt.x - (ed->curx - ed->leftcol);
+  if (top < 0 || left < 0 || top + ed->rows > current->rows) {
+    snprintf(message, sizeof message, "the cursor at %d,%d is not where the buffer has it", vt.y, vt.x);
+    fail(message);
+    return;
+  }
+  for (row_t y = 0; y < ed->rows; y ++) {
+    expected_row(y, left, row);
+    if (memcmp(&vt.cells[top + y][left], row, vt.cols - left) != 0) {
+      snprintf(message, sizeof message, "row %d after %u keys:\n  shown    |%.*s|\n  expected |%s|",
+               top + y, (unsigned) key_pos, vt.cols - left, &vt.cells[top + y][left], row);
+      fail(message);
+      return;
+    }
+  }
+}
+
+void
+host_write(const char *str, size_t len)
+{
+  sent += len;
+  vt_write(&vt, str, len);
+}
+
+int
+host_ready(void)
+{
+  return vt.reply_pos < vt.reply_len || key_pos < key_length;
+}
+
+int
+host_read(void)
+{
+  int ch = vt_reply(&vt);
+  if (ch >= 0) {
+    return ch;
+  }
+  if (key_pos >= key_length) {
+    mp_raise_msg(&mp_type_RuntimeError, "the keys ran out");
+  }
+  check_screen();
+  return (uint8_t) keys[key_pos ++];
+}
+
+static mp_obj_t
+call(const char *name, size_t n_args, const mp_obj_t *args)
+{
+  const mp_map_t *map = &editor_module.globals->map;
+  for (size_t i = 0; i < map->used; i ++) {
+    if (strcmp((const char *) map->table[i].key, name) != 0) {
+      continue;
+    }
+    const mp_obj_fun_builtin_t *fun = map->table[i].value;
+    if (fun->nargs_max >= MP_FUN_VAR) {
+      return ((mp_obj_t (*)(size_t, const mp_obj_t *)) fun->fun)(n_args, args);
+    } else if (n_args == 0) {
+      return ((mp_obj_t (*)(void)) fun->fun)();
+    } else if (n_args == 1) {
+      return ((mp_obj_t (*)(mp_obj_t)) fun->fun)(args[0]);
+    }
+    return ((mp_obj_t (*)(mp_obj_t, mp_obj_t)) fun->fun)(args[0], args[1]);
+  }
+  fprintf(stderr, "editor.%s is missing\n", name);
+  exit(2);
+}
+
+static void
+call_flag(const char *name, int flag)
+{
+  mp_obj_t arg = flag ? mp_const_true : mp_const_false;
+  call(name, 1, &arg);
+}
+
+static void
+write_text(const char *path)
+{
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL || fwrite(text, 1, sizeof text - 1, fp) != sizeof text - 1 || fclose(fp) != 0) {
+    perror(path);
+    exit(2);
+  }
+}
+
+static unsigned long
+run_scenario(const scenario_t *s)
+{
+  write_text(TEXT_FILE);
+  write_text(OTHER_FILE);
+  current = s;
+  failure[0] = '\0';
+  vt_init(&vt, s->rows + 1, s->cols, (s->options & SYNC) != 0);
+  keys = s->keys;
+  key_pos = 0;
+  key_length = strlen(s->keys);
+  sent = 0;
+
+  nlr_buf_t nlr;
+  if (nlr_push(&nlr) == 0) {
+    mp_obj_t args[2] = { mp_obj_new_int(s->cols), mp_obj_new_int(s->rows) };
+    call("set_screen", (s->options & DETECT) ? 0 : 2, args);
+    call_flag("set_wrap", s->options & WRAP);
+    call_flag("set_highlight", s->options & HIGHLIGHT);
+    call_flag("set_line_numbers", s->options & LINE_NUMBERS);
+    call_flag("set_status", s->options & STATUS);
+    mp_obj_t filenames[2] = {
+      mp_obj_new_str(TEXT_FILE, strlen(TEXT_FILE)),
+      mp_obj_new_str(OTHER_FILE, strlen(OTHER_FILE)),
+    };
+    call("edit", (s->options & TWO_FILES) ? 2 : 1, filenames);
+    nlr_pop();
+  } else {
+    fail(stub_error);
+  }
+  if (vt.error[0] != '\0') {
+    fail(vt.error);
+  }
+  if (key_pos < key_length) {
+    fail("the session ended before the keys");
+  }
+  if ((s->options & SYNC) && vt.sync_count == 0) {
+    fail("no frame was synchronized");
+  }
+  remove(TEXT_FILE);
+  remove(OTHER_FILE);
+  return sent;
+}
+
+static void
+print_screen()
+{
+  for (int y = 0; y < vt.rows; y ++) {
+    printf("  |%.*s|\n", vt.cols, vt.cells[y]);
+  }
+}
+
+static void
+read_budgets(const char *path)
+{
+  char line[128];
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof line, fp) != NULL && budget_count < MAX_SCENARIOS) {
+    if (line[0] == '#' || sscanf(line, "%31s %lu", budgets[budget_count].name, &budgets[budget_count].bytes) != 2) {
+      continue;
+    }
+    budget_count ++;
+  }
+  fclose(fp);
+}
+
+static long
+find_budget(const char *name)
+{
+  for (int i = 0; i < budget_count; i ++) {
+    if (strcmp(budgets[i].name, name) == 0) {
+      return (long) budgets[i].bytes;
+    }
+  }
+  return -1;
+}
+
+int
+main(int argc, char **argv)
+{
+  int update = (argc > 2 && strcmp(argv[1], "-u") == 0);
+  int verbose = (argc > 2 && strcmp(argv[1], "-v") == 0);
+  if (argc != 2 + update + verbose) {
+    fprintf(stderr, "usage: %s [-u|-v] budgets.txt\n", argv[0]);
+    return 2;
+  }
+  const char *path = argv[argc - 1];
+  read_budgets(path);
+
+  FILE *out = NULL;
+  if (update) {
+    out = fopen(path, "w");
+    if (out == NULL) {
+      perror(path);
+      return 2;
+    }
+    fprintf(out, "# bytes sent to the terminal by each scenario of screen_test.c\n");
+    fprintf(out, "# a scenario fails when it sends more; rewrite with make budgets\n");
+  }
+  int failures = 0;
+  for (size_t i = 0; i < MP_ARRAY_SIZE(scenarios); i ++) {
+    const scenario_t *s = &scenarios[i];
+    unsigned long bytes = run_scenario(s);
+    long budget = find_budget(s->name);
+    if (failure[0] == '\0' && !update) {
+      if (budget < 0) {
+        fail("no budget");
+      } else if (bytes > (unsigned long) budget) {
+        snprintf(failure, sizeof failure, "%lu bytes sent, over the budget of %ld", bytes, budget);
+      }
+    }
+    if (failure[0] != '\0') {
+      printf("FAIL %s: %s\n", s->name, failure);
+      failures ++;
+    } else {
+      printf("ok   %-14s %6lu bytes (budget %ld)\n", s->name, bytes, update ? (long) bytes : budget);
+    }
+    if (verbose) {
+      print_screen();
+    }
+    if (out != NULL) {
+      fprintf(out, "%s %lu\n", s->name, bytes);
+    }
+  }
+  if (out != NULL) {
+    fclose(out);
+  }
+  printf("%d of %d scenarios failed\n", failures, (int) MP_ARRAY_SIZE(scenarios));
+  return failures ? 1 : 0;
+}
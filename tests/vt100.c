@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+#include "vt100.h"
+
+#define ESC '\033'
+
+enum {VT_GROUND = 0, VT_ESC, VT_CSI};
+
+static void put_cell(vt_t *vt, char ch);
+static void line_feed(vt_t *vt);
+static void scroll(vt_t *vt, int n);
+static void erase(vt_t *vt, int y, int from, int to);
+static void do_csi(vt_t *vt, char final);
+static void do_sgr(vt_t *vt);
+static void do_mode(vt_t *vt, int set);
+static void add_reply(vt_t *vt, const char *str);
+static void unknown(vt_t *vt, const char *what, char final);
+static int param(vt_t *vt, int i, int def);
+
+void
+vt_init(vt_t *vt, int rows, int cols, int has_sync)
+{
+  memset(vt, 0, sizeof *vt);
+  vt->rows = rows < VT_MAX_ROWS ? rows : VT_MAX_ROWS;
+  vt->cols = cols < VT_MAX_COLS ? cols : VT_MAX_COLS;
+  memset(vt->cells, ' ', sizeof vt->cells);
+  vt->bottom = vt->rows - 1;
+  vt->cursor_visible = 1;
+  vt->has_sync = has_sync;
+}
+
+void
+vt_write(vt_t *vt, const char *str, size_t len)
+{
+  for (size_t i = 0; i < len; i ++) {
+    char ch = str[i];
+    switch (vt->state) {
+    case VT_GROUND:
+      if (ch == ESC) {
+        vt->state = VT_ESC;
+      } else if (ch == '\r') {
+        vt->x = 0;
+        vt->wrap_pending = 0;
+      } else if (ch == '\n') {
+        line_feed(vt);
+      } else if (ch == '\b') {
+        if (vt->x > 0) {
+          vt->x --;
+        }
+        vt->wrap_pending = 0;
+      } else if ((uint8_t) ch >= 0x80 && (uint8_t) ch < 0xC0) {
+        /* the rest of a UTF-8 character stays in its cell */
+      } else if ((uint8_t) ch >= ' ') {
+        put_cell(vt, ch);
+      } else {
+        unknown(vt, "control", ch);
+      }
+      break;
+    case VT_ESC:
+      vt->state = VT_GROUND;
+      if (ch == '[') {
+        vt->state = VT_CSI;
+        vt->private_mode = vt->intermediate = 0;
+        vt->param_count = 0;
+        memset(vt->params, 0, sizeof vt->params);
+      } else if (ch == '7') {
+        vt->saved_y = vt->y;
+        vt->saved_x = vt->x;
+      } else if (ch == '8') {
+        vt->y = vt->saved_y;
+        vt->x = vt->saved_x;
+        vt->wrap_pending = 0;
+      } else {
+        unknown(vt, "ESC", ch);
+      }
+      break;
+    case VT_CSI:
+      if (ch >= '0' && ch <= '9') {
+        if (vt->param_count == 0) {
+          vt->param_count = 1;
+        }
+        if (vt->param_count <= VT_MAX_PARAMS) {
+          int *p = &vt->params[vt->param_count - 1];
+          *p = *p * 10 + ch - '0';
+        }
+      } else if (ch == ';') {
+        vt->param_count = (vt->param_count == 0) ? 2 : vt->param_count + 1;
+      } else if (ch == '?' && vt->param_count == 0) {
+        vt->private_mode = 1;
+      } else if (ch >= ' ' && ch <= '/') {
+        vt->intermediate = ch;
+      } else {
+        vt->state = VT_GROUND;
+        do_csi(vt, ch);
+      }
+      break;
+    }
+  }
+}
+
+/* the next byte of a report, -1 without one */
+int
+vt_reply(vt_t *vt)
+{
+  if (vt->reply_pos >= vt->reply_len) {
+    vt->reply_pos = vt->reply_len = 0;
+    return -1;
+  }
+  return (uint8_t) vt->reply[vt->reply_pos ++];
+}
+
+static void
+put_cell(vt_t *vt, char ch)
+{
+  if (vt->wrap_pending) {
+    vt->x = 0;
+    vt->wrap_pending = 0;
+    line_feed(vt);
+  }
+  vt->cells[vt->y][vt->x] = ch;
+  if (vt->x == vt->cols - 1) {
+    vt->wrap_pending = 1;
+  } else {
+    vt->x ++;
+  }
+}
+
+static void
+line_feed(vt_t *vt)
+{
+  vt->wrap_pending = 0;
+  if (vt->y == vt->bottom) {
+    scroll(vt, 1);
+  } else if (vt->y < vt->rows - 1) {
+    vt->y ++;
+  }
+}
+
+/* up by n rows in the scroll region, down with a negative n */
+static void
+scroll(vt_t *vt, int n)
+{
+  int height = vt->bottom - vt->top + 1;
+  if (n > height) {
+    n = height;
+  } else if (n < -height) {
+    n = -height;
+  }
+  if (n > 0) {
+    memmove(vt->cells[vt->top], vt->cells[vt->top + n], (size_t) (height - n) * VT_MAX_COLS);
+    for (int y = vt->bottom - n + 1; y <= vt->bottom; y ++) {
+      erase(vt, y, 0, vt->cols);
+    }
+  } else if (n < 0) {
+    n = -n;
+    memmove(vt->cells[vt->top + n], vt->cells[vt->top], (size_t) (height - n) * VT_MAX_COLS);
+    for (int y = vt->top; y < vt->top + n; y ++) {
+      erase(vt, y, 0, vt->cols);
+    }
+  }
+}
+
+static void
+erase(vt_t *vt, int y, int from, int to)
+{
+  memset(&vt->cells[y][from], ' ', (size_t) (to - from));
+}
+
+static void
+do_csi(vt_t *vt, char final)
+{
+  if (vt->private_mode) {
+    if (final == 'h' || final == 'l') {
+      do_mode(vt, final == 'h');
+    } else if (final == 'p' && vt->intermediate == '$') {
+      /* DECRQM: 1 set, 2 reset, 0 not recognized */
+      char buf[VT_REPLY_SIZE];
+      int mode = param(vt, 0, 0);
+      int value = (mode == 2026 && vt->has_sync) ? (vt->sync ? 1 : 2) : (mode == 25) ? (vt->cursor_visible ? 1 : 2) : 0;
+      snprintf(buf, sizeof buf, "%c[?%d;%d$y", ESC, mode, value);
+      add_reply(vt, buf);
+    } else {
+      unknown(vt, "CSI ?", final);
+    }
+    return;
+  }
+  if (vt->intermediate) {
+    unknown(vt, "CSI with intermediate", final);
+    return;
+  }
+  int n;
+  switch (final) {
+  case 'H':
+  case 'f':
+    vt->y = param(vt, 0, 1) - 1;
+    vt->x = param(vt, 1, 1) - 1;
+    vt->y = vt->y < vt->rows ? vt->y : vt->rows - 1;
+    vt->x = vt->x < vt->cols ? vt->x : vt->cols - 1;
+    vt->wrap_pending = 0;
+    break;
+  case 'K':
+    n = param(vt, 0, 0);
+    if (n == 0) {
+      erase(vt, vt->y, vt->x, vt->cols);
+    } else if (n == 1) {
+      erase(vt, vt->y, 0, vt->x + 1);
+    } else {
+      erase(vt, vt->y, 0, vt->cols);
+    }
+    break;
+  case 'J':
+    n = param(vt, 0, 0);
+    if (n == 0) {
+      erase(vt, vt->y, vt->x, vt->cols);
+      for (int y = vt->y + 1; y < vt->rows; y ++) {
+        erase(vt, y, 0, vt->cols);
+      }
+    } else if (n == 1) {
+      for (int y = 0; y < vt->y; y ++) {
+        erase(vt, y, 0, vt->cols);
+      }
+      erase(vt, vt->y, 0, vt->x + 1);
+    } else {
+      for (int y = 0; y < vt->rows; y ++) {
+        erase(vt, y, 0, vt->cols);
+      }
+    }
+    break;
+  case 'm':
+    do_sgr(vt);
+    break;
+  case 'r':
+    vt->top = param(vt, 0, 1) - 1;
+    vt->bottom = param(vt, 1, vt->rows) - 1;
+    if (vt->bottom >= vt->rows) {
+      vt->bottom = vt->rows - 1;
+    }
+    if (vt->top >= vt->bottom) {
+      vt->top = 0;
+      vt->bottom = vt->rows - 1;
+    }
+    vt->y = vt->x = 0;
+    vt->wrap_pending = 0;
+    break;
+  case 'S':
+    scroll(vt, param(vt, 0, 1));
+    break;
+  case 'T':
+    scroll(vt, -param(vt, 0, 1));
+    break;
+  case 'n':
+    if (param(vt, 0, 0) == 6) {
+      char buf[VT_REPLY_SIZE];
+      snprintf(buf, sizeof buf, "%c[%d;%dR", ESC, vt->y + 1, vt->x + 1);
+      add_reply(vt, buf);
+    } else {
+      unknown(vt, "DSR", final);
+    }
+    break;
+  default:
+    unknown(vt, "CSI", final);
+    break;
+  }
+}
+
+static void
+do_sgr(vt_t *vt)
+{
+  int count = vt->param_count ? vt->param_count : 1;
+  for (int i = 0; i < count && i < VT_MAX_PARAMS; i ++) {
+    int p = vt->params[i];
+    if (p == 0) {
+      vt->attr = 0;
+    } else if (p == 1 || p == 7) {
+      vt->attr |= 1 << p;
+    } else if (p >= 30 && p <= 37) {
+      vt->attr = (vt->attr & ~0xFF00) | (p << 8);
+    } else {
+      unknown(vt, "SGR", (char) ('0' + p % 10));
+    }
+  }
+}
+
+static void
+do_mode(vt_t *vt, int set)
+{
+  int mode = param(vt, 0, 0);
+  if (mode == 25) {
+    vt->cursor_visible = set;
+  } else if (mode == 2026) {
+    /* a terminal without the mode ignores it */
+    vt->sync = vt->has_sync && set;
+    vt->sync_count += vt->sync;
+  } else {
+    unknown(vt, "mode", set ? 'h' : 'l');
+  }
+}
+
+static void
+add_reply(vt_t *vt, const char *str)
+{
+  size_t len = strlen(str);
+  if (vt->reply_len + len > sizeof vt->reply) {
+    unknown(vt, "too many reports", str[len - 1]);
+    return;
+  }
+  memcpy(vt->reply + vt->reply_len, str, len);
+  vt->reply_len += len;
+}
+
+static void
+unknown(vt_t *vt, const char *what, char final)
+{
+  if (vt->error[0] == '\0') {
+    snprintf(vt->error, sizeof vt->error, "unknown %s 0x%02x", what, (uint8_t) final);
+  }
+}
+
+static int
+param(vt_t *vt, int i, int def)
+{
+  if (i >= vt->param_count || i >= VT_MAX_PARAMS || vt->params[i] == 0) {
+    return def;
+  }
+  return vt->params[i];
+}
@@ -0,0 +1,48 @@
+#ifndef __VT100_H
+#define __VT100_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VT_MAX_ROWS     64
+#define VT_MAX_COLS     160
+#define VT_MAX_PARAMS   4
+#define VT_REPLY_SIZE   32
+
+/*
+ * A terminal that keeps what ucurses draws: cursor movement, erasing,
+ * attributes, the scroll region, the cursor visibility and the
+ * synchronized output mode. The reports asked for (the cursor position
+ * and DECRQM) are queued to be read back as keys. A sequence it does not
+ * know is kept in error.
+ */
+typedef struct {
+  int rows, cols;
+  char cells[VT_MAX_ROWS][VT_MAX_COLS];
+  int y, x, wrap_pending;
+  int saved_y, saved_x;
+  int top, bottom;
+  int attr;
+  int cursor_visible;
+  int has_sync, sync, sync_count;
+  int state;
+  int private_mode, intermediate;
+  int params[VT_MAX_PARAMS], param_count;
+  char reply[VT_REPLY_SIZE];
+  size_t reply_len, reply_pos;
+  char error[64];
+} vt_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void vt_init(vt_t *vt, int rows, int cols, int has_sync);
+  void vt_write(vt_t *vt, const char *str, size_t len);
+  int vt_reply(vt_t *vt);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __VT100_H */